@@ -0,0 +1,258 @@
+// batch.cpp
+// Copyright (c) 2021, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "ast.h"
+#include "defs.h"
+#include "queue.h"
+
+#include <set>
+#include <memory>
+#include <thread>
+#include <algorithm>
+
+// file.cpp
+zst::Result<std::vector<zbuf::str_view>, std::string> read_file_lines(zbuf::str_view path);
+
+namespace lc
+{
+	// repl.cpp
+	zbuf::str_view trim(zbuf::str_view s);
+	void runReplCommand(Context& ctx, zbuf::str_view cmd);
+	void parseError(parser::Error e, zbuf::str_view input);
+	void print_replacing_vars(Context& ctx, const ast::Expr* e);
+
+	// util.cpp
+	ast::Expr* replace_vars(const Context& ctx, const ast::Expr* expr);
+	void splice_registers(const Context& ctx, ast::Expr** expr);
+	std::set<std::string> find_free_names(const ast::Expr* expr);
+
+	namespace {
+		struct Job
+		{
+			size_t seq = 0;
+			int flags = 0;
+
+			// already expanded, so the evaluators never need to look at the context.
+			ast::Expr* expr = nullptr;
+
+			// the context as of this line, for printing. lets never free the old value,
+			// so a shallow copy stays valid even after the name is redefined.
+			std::shared_ptr<Context> ctx;
+
+			zbuf::str_view line;
+			std::optional<parser::Error> error;
+		};
+
+		struct Pipeline
+		{
+			Pipeline(Context& ctx, size_t workers) : ctx(ctx), parsed(4 * workers), reduced(4 * workers) { }
+
+			Context& ctx;
+			std::shared_ptr<Context> snapshot;
+
+			BoundedQueue<Job> parsed;
+			BoundedQueue<Job> reduced;
+
+			size_t submitted = 0;
+
+			std::mutex lock;
+			std::condition_variable cond;
+			size_t printed = 0;
+		};
+	}
+
+	// commands print things and change the flags, so everything before them must be
+	// out of the pipeline first.
+	static void wait_for_printer(Pipeline& pl)
+	{
+		std::unique_lock<std::mutex> lk(pl.lock);
+		pl.cond.wait(lk, [&pl]() { return pl.printed == pl.submitted; });
+	}
+
+	// only what printing needs. the memo tables are not copied: the evaluators insert into them
+	// (through the lambdas that point at them) while this runs, and they're only read under the lock.
+	// the printer adds to the results, so those are copied under `pl.lock`.
+	static std::shared_ptr<Context> snapshot(Pipeline& pl)
+	{
+		auto ret = std::make_shared<Context>();
+		ret->flags = pl.ctx.flags;
+		ret->vars = pl.ctx.vars;
+
+		std::lock_guard<std::mutex> lk(pl.lock);
+		ret->results = pl.ctx.results;
+
+		return ret;
+	}
+
+	// whatever is still free after replace_vars and is named like a register.
+	static bool uses_registers(const ast::Expr* expr)
+	{
+		auto names = find_free_names(expr);
+		return std::any_of(names.begin(), names.end(), [](auto& name) { return name == "it" || name[0] == '$'; });
+	}
+
+	static void submit(Pipeline& pl, Job job)
+	{
+		job.seq = pl.submitted++;
+		pl.parsed.push(std::move(job));
+	}
+
+	static void read_stage(Pipeline& pl, zbuf::str_view path)
+	{
+		auto lines_or_err = read_file_lines(path);
+		if(!lines_or_err)
+			return wait_for_printer(pl), printError(lines_or_err.error());
+
+		auto lines = std::move(lines_or_err.unwrap());
+		for(size_t i = 0; i < lines.size(); i++)
+		{
+			auto line = trim(lines[i]);
+			if(line.empty() || line[0] == '#')
+				continue;
+
+			if(line.find(":load ") == 0)
+			{
+				read_stage(pl, trim(line.drop(strlen(":load "))));
+				continue;
+			}
+			else if(line[0] == ':')
+			{
+				wait_for_printer(pl);
+				runReplCommand(pl.ctx, line);
+
+				pl.snapshot.reset();
+				continue;
+			}
+
+			Job job { };
+			job.line = line;
+
+			auto expr_or_err = parser::parse(line);
+			if(!expr_or_err)
+			{
+				auto err = expr_or_err.error();
+				err.msg = zpr::sprint("(line {}): {}", i + 1, err.msg);
+				job.error = err;
+
+				submit(pl, std::move(job));
+				continue;
+			}
+
+			auto expr = expr_or_err.unwrap();
+			if(expr->type == ast::EXPR_LET)
+			{
+				lc::evaluate(pl.ctx, expr, pl.ctx.flags & ~(FLAG_TRACE | FLAG_FULL_TRACE));
+				pl.snapshot.reset();
+			}
+			else if(expr->type == ast::EXPR_ASSERT)
+			{
+				wait_for_printer(pl);
+				lc::checkAssertion(pl.ctx, expr, pl.ctx.flags);
+			}
+			else
+			{
+				// tracing from several threads at once would just be noise.
+				job.flags = pl.ctx.flags & ~(FLAG_TRACE | FLAG_FULL_TRACE | FLAG_PROGRESS);
+				job.expr = replace_vars(pl.ctx, expr);
+
+				// the printer keeps the results, so a line that uses one has to wait for everything
+				// before it to be printed; other lines can still overlap with the evaluators.
+				if(uses_registers(job.expr))
+				{
+					wait_for_printer(pl);
+					splice_registers(pl.ctx, &job.expr);
+
+					pl.snapshot.reset();
+				}
+
+				if(!pl.snapshot)
+					pl.snapshot = snapshot(pl);
+
+				job.ctx = pl.snapshot;
+
+				submit(pl, std::move(job));
+			}
+
+			delete expr;
+		}
+	}
+
+	static void eval_stage(Pipeline& pl)
+	{
+		while(auto job = pl.parsed.pop())
+		{
+			if(job->expr != nullptr)
+				job->expr = lc::reduce(job->expr, job->flags);
+
+			pl.reduced.push(std::move(*job));
+		}
+	}
+
+	static void print_stage(Pipeline& pl)
+	{
+		// results arrive in whatever order the evaluators finish them,
+		// so hold on to them until it's their turn.
+		size_t next = 0;
+		std::map<size_t, Job> waiting;
+
+		while(auto job = pl.reduced.pop())
+		{
+			auto seq = job->seq;
+			waiting.emplace(seq, std::move(*job));
+
+			for(auto it = waiting.find(next); it != waiting.end(); it = waiting.find(next))
+			{
+				auto& j = it->second;
+				if(j.error.has_value())
+				{
+					parseError(*j.error, j.line);
+				}
+				else
+				{
+					size_t n = 0;
+					{
+						std::lock_guard<std::mutex> lk(pl.lock);
+						pl.ctx.results.push_back(j.expr);
+						n = pl.ctx.results.size();
+					}
+
+					zpr::print("{}${}:{} ", BLACK_BOLD, n, COLOUR_RESET);
+					print_replacing_vars(*j.ctx, j.expr);
+				}
+
+				waiting.erase(it);
+				next++;
+
+				std::lock_guard<std::mutex> lk(pl.lock);
+				pl.printed = next;
+				pl.cond.notify_all();
+			}
+		}
+	}
+
+	void runBatch(Context& ctx, const std::vector<zbuf::str_view>& paths)
+	{
+		size_t workers = std::max(1u, std::thread::hardware_concurrency());
+		Pipeline pl(ctx, workers);
+
+		std::vector<std::thread> evaluators;
+		for(size_t i = 0; i < workers; i++)
+			evaluators.emplace_back(eval_stage, std::ref(pl));
+
+		auto printer = std::thread(print_stage, std::ref(pl));
+
+		for(auto path : paths)
+			read_stage(pl, path);
+
+		pl.parsed.close();
+		for(auto& t : evaluators)
+			t.join();
+
+		pl.reduced.close();
+		printer.join();
+
+		// the profile covers the whole run.
+		lc::reportProfile();
+	}
+}
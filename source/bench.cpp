@@ -0,0 +1,170 @@
+// bench.cpp
+// Copyright (c) 2021, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "ast.h"
+#include "defs.h"
+#include "store.h"
+
+#include <chrono>
+
+namespace lc
+{
+	using namespace ast;
+	using Clock = std::chrono::steady_clock;
+
+	// repl.cpp
+	void parseError(parser::Error e, zbuf::str_view input);
+
+	// util.cpp
+	Expr* replace_vars(const Context& ctx, const Expr* expr);
+	void splice_registers(const Context& ctx, Expr** expr);
+	void force_all(Expr* expr);
+	extern thread_local size_t renamed_nodes;
+
+	// every engine gets the same budget. the stores never free anything, so they are
+	// compacted whenever they grow past BENCH_COMPACT_BYTES.
+	constexpr int BENCH_MAX_STEPS       = 1000000;
+	constexpr int BENCH_TIMEOUT_MS      = 10000;
+	constexpr int BENCH_CHUNK_STEPS     = 1000;
+	constexpr size_t BENCH_COMPACT_BYTES = 64 * 1024 * 1024;
+
+	namespace {
+		struct Result
+		{
+			const char* name = nullptr;
+
+			bool finished = false;
+			int steps = 0;
+			double ms = 0;
+			size_t peak_bytes = 0;
+
+			// for the in-place evaluator, how many nodes α-conversion had to touch.
+			std::optional<size_t> renamed = std::nullopt;
+
+			// always an ordinary ast::Expr, so the engines can be compared.
+			Expr* normal = nullptr;
+		};
+	}
+
+	// the existing in-place evaluator, for reference. note that its step count includes α-conversions.
+	static Result run_in_place(const char* name, const Expr* input, int flags)
+	{
+		auto ret = Result { name };
+		auto start = Clock::now();
+		auto deadline = start + std::chrono::milliseconds(BENCH_TIMEOUT_MS);
+		auto renamed = renamed_nodes;
+
+		auto expr = input->clone();
+		while(ret.steps < BENCH_MAX_STEPS)
+		{
+			int n = 0;
+			ret.finished = reduce(&expr, flags, std::min(BENCH_CHUNK_STEPS, BENCH_MAX_STEPS - ret.steps), n);
+			ret.steps += n;
+
+			if(ret.finished || Clock::now() > deadline)
+				break;
+		}
+
+		force_all(expr);
+
+		ret.ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		ret.renamed = renamed_nodes - renamed;
+		ret.normal = expr;
+
+		return ret;
+	}
+
+	template <typename S>
+	static Result run_store(const char* name, const Expr* input)
+	{
+		auto ret = Result { name };
+		auto start = Clock::now();
+		auto deadline = start + std::chrono::milliseconds(BENCH_TIMEOUT_MS);
+
+		S s;
+		auto r = store::import_expr(s, input);
+
+		while(ret.steps < BENCH_MAX_STEPS)
+		{
+			int n = 0;
+			ret.finished = store::normalise(s, r, std::min(BENCH_CHUNK_STEPS, BENCH_MAX_STEPS - ret.steps), n);
+			ret.steps += n;
+			ret.peak_bytes = std::max(ret.peak_bytes, s.footprint());
+
+			if(ret.finished || Clock::now() > deadline)
+				break;
+
+			if(s.footprint() > BENCH_COMPACT_BYTES)
+				store::compact(s, r);
+		}
+
+		ret.ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		ret.normal = store::export_expr(s, r);
+
+		return ret;
+	}
+
+	// :bench expr -- normalises `expr` with every engine, and compares the time, steps, and memory.
+	void runBench(Context& ctx, zbuf::str_view input)
+	{
+		auto expr_or_error = parser::parse(input);
+		if(!expr_or_error)
+			return parseError(expr_or_error.error(), input);
+
+		auto parsed = expr_or_error.unwrap();
+		if(parsed->type != EXPR_APPLY && parsed->type != EXPR_LAMBDA && parsed->type != EXPR_VAR)
+		{
+			delete parsed;
+			return printError("expected an expression for ':bench'");
+		}
+
+		auto expr = replace_vars(ctx, parsed);
+		splice_registers(ctx, &expr);
+		delete parsed;
+
+		std::vector<Result> results;
+		results.push_back(run_in_place("in-place", expr, /* flags: */ 0));
+		results.push_back(run_in_place("lazy", expr, FLAG_LAZY_RENAME));
+		results.push_back(run_store<store::Tree>("tree", expr));
+		results.push_back(run_store<store::Pool>("pool", expr));
+		results.push_back(run_store<store::Flat>("flat", expr));
+
+		auto ast = store::Ast();
+		auto& reference = results.front();
+		auto reference_hash = store::hash(ast, reference.normal);
+
+		zpr::println("{}*.{} {} nodes in, {} nodes out", BLACK_BOLD, COLOUR_RESET, store::size(ast, expr),
+			store::size(ast, reference.normal));
+
+		for(auto& r : results)
+		{
+			std::string memory;
+			if(r.peak_bytes > 0)
+				memory = zpr::sprint(", {.1f} KiB peak", r.peak_bytes / 1024.0);
+
+			else if(r.renamed)
+				memory = zpr::sprint(", {} renamed", *r.renamed);
+
+			std::string note;
+			if(!r.finished)
+				note = zpr::sprint(" {}(gave up){}", YELLOW_BOLD, COLOUR_RESET);
+
+			else if(reference.finished && (store::hash(ast, r.normal) != reference_hash
+				|| !store::alpha_equivalent(ast, r.normal, reference.normal)))
+			{
+				note = zpr::sprint(" {}(different result){}", RED_BOLD, COLOUR_RESET);
+			}
+
+			zpr::println("  {}{}{}{} steps, {.2f} ms{}{}", BLACK_BOLD, zpr::w(10)(r.name), COLOUR_RESET,
+				zpr::w(10)(r.steps), r.ms, memory, note);
+		}
+
+		zpr::println("{}", lc::print(reference.normal, ctx.flags));
+
+		for(auto& r : results)
+			delete r.normal;
+
+		delete expr;
+	}
+}
@@ -0,0 +1,266 @@
+// check.cpp
+// Copyright (c) 2021, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "ast.h"
+#include "defs.h"
+#include "queue.h"
+
+#include <chrono>
+#include <thread>
+
+// file.cpp
+zst::Result<std::vector<zbuf::str_view>, std::string> read_file_lines(zbuf::str_view path);
+
+namespace lc
+{
+	using namespace ast;
+	using Clock = std::chrono::steady_clock;
+
+	// repl.cpp
+	zbuf::str_view trim(zbuf::str_view s);
+	void runReplCommand(Context& ctx, zbuf::str_view cmd);
+	void parseError(parser::Error e, zbuf::str_view input);
+
+	// util.cpp
+	Expr* replace_vars(const Context& ctx, const Expr* expr);
+	void splice_registers(const Context& ctx, Expr** expr);
+	bool alpha_equivalent(const Expr* a, const Expr* b);
+	void force_all(Expr* expr);
+
+	// the evaluator doesn't know about the clock, so reduce this many steps at a time
+	// and look at the deadline in between.
+	constexpr int CHECK_CHUNK_STEPS = 1000;
+
+	namespace {
+		struct Check
+		{
+			~Check() { delete this->expr; delete this->expected; }
+
+			// already expanded, so the workers never need to look at the context.
+			Expr* expr = nullptr;
+			Expr* expected = nullptr;
+
+			// "file:line", or empty in the repl.
+			std::string where;
+			zbuf::str_view line;
+
+			// the context's, as of the assertion; only the ones that affect reduction matter.
+			int flags = 0;
+
+			bool finished = false;
+			bool passed = false;
+			int steps = 0;
+			double ms = 0;
+		};
+
+		struct Limits
+		{
+			int max_steps;
+			Clock::time_point deadline;
+		};
+	}
+
+	static void expand(Context& ctx, const Assert* assertion, Check& check)
+	{
+		check.flags = ctx.flags & ~(FLAG_TRACE | FLAG_FULL_TRACE | FLAG_PROGRESS);
+		check.expr = replace_vars(ctx, assertion->expr);
+		check.expected = replace_vars(ctx, assertion->expected);
+
+		splice_registers(ctx, &check.expr);
+		splice_registers(ctx, &check.expected);
+	}
+
+	// both sides share the same budget, so `expected` only gets the steps that `expr` left over;
+	// returns false if it ran out.
+	static bool reduce_within(Expr** expr, int flags, const Limits& limits, int& steps)
+	{
+		while(steps < limits.max_steps)
+		{
+			int n = 0;
+			bool done = reduce(expr, flags, std::min(CHECK_CHUNK_STEPS, limits.max_steps - steps), n);
+			steps += n;
+
+			if(done)
+				return true;
+
+			if(Clock::now() > limits.deadline)
+				return false;
+		}
+
+		// reduce() stops at the limit without looking at the term, so the last step might have
+		// left a normal form. if a copy has no step to take, it did.
+		int n = 0;
+		auto copy = (*expr)->clone();
+		bool done = reduce(&copy, flags, 1, n);
+
+		delete copy;
+		return done;
+	}
+
+	static void run_check(Check* check, int max_steps, int timeout_ms)
+	{
+		auto start = Clock::now();
+		auto limits = Limits { max_steps, start + std::chrono::milliseconds(timeout_ms) };
+
+		check->finished = reduce_within(&check->expr, check->flags, limits, check->steps)
+			&& reduce_within(&check->expected, check->flags, limits, check->steps);
+
+		// nothing outside the evaluator knows about suspended renamings.
+		if(check->flags & FLAG_LAZY_RENAME)
+		{
+			force_all(check->expr);
+			force_all(check->expected);
+		}
+
+		check->passed = check->finished && alpha_equivalent(check->expr, check->expected);
+		check->ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	static void print_check(const Check* check, int print_flags)
+	{
+		auto [ colour, status ] = check->passed ? std::make_pair(GREEN_BOLD, "pass ")
+			: check->finished ? std::make_pair(RED_BOLD, "fail ")
+			: std::make_pair(YELLOW_BOLD, "limit");
+
+		zpr::println("{}{}{} {}{}{}{}({} step{}, {.2f} ms)", colour, status, COLOUR_RESET, BLACK_BOLD, check->where,
+			COLOUR_RESET, check->where.empty() ? "" : "  ", check->steps, check->steps == 1 ? "" : "s", check->ms);
+
+		if(check->passed)
+			return;
+
+		if(!check->line.empty())
+			zpr::println("      {}", check->line);
+
+		if(check->finished)
+		{
+			zpr::println("      {}expected:{} {}", GREY_BOLD, COLOUR_RESET, lc::print(check->expected, print_flags));
+			zpr::println("      {}got:{}      {}", GREY_BOLD, COLOUR_RESET, lc::print(check->expr, print_flags));
+		}
+	}
+
+	bool checkAssertion(Context& ctx, const Expr* assertion, int print_flags)
+	{
+		Check check;
+		expand(ctx, dynamic_cast<const Assert*>(assertion), check);
+
+		run_check(&check, DEFAULT_CHECK_STEPS, DEFAULT_CHECK_TIMEOUT_MS);
+		print_check(&check, print_flags);
+
+		return check.passed;
+	}
+
+	// lets and commands are run in order as the files are read, and each assertion is expanded
+	// against the definitions at that point; only the reduction happens on the workers. files that
+	// can't be read and lines that don't parse are counted in `errors`.
+	static void read_checks(Context& ctx, zbuf::str_view path, std::deque<Check>& checks, BoundedQueue<Check*>& queue,
+		size_t& errors)
+	{
+		auto lines_or_err = read_file_lines(path);
+		if(!lines_or_err)
+		{
+			errors++;
+			return printError(lines_or_err.error());
+		}
+
+		auto lines = std::move(lines_or_err.unwrap());
+		for(size_t i = 0; i < lines.size(); i++)
+		{
+			auto line = trim(lines[i]);
+			if(line.empty() || line[0] == '#')
+				continue;
+
+			if(line.find(":load ") == 0)
+			{
+				read_checks(ctx, trim(line.drop(strlen(":load "))), checks, queue, errors);
+				continue;
+			}
+			else if(line[0] == ':')
+			{
+				runReplCommand(ctx, line);
+				continue;
+			}
+
+			auto expr_or_err = parser::parse(line);
+			if(!expr_or_err)
+			{
+				auto err = expr_or_err.error();
+				err.msg = zpr::sprint("({}:{}): {}", path, i + 1, err.msg);
+				parseError(err, line);
+
+				errors++;
+				continue;
+			}
+
+			// plain expressions don't check anything, so don't bother evaluating them.
+			auto expr = expr_or_err.unwrap();
+			if(expr->type == EXPR_LET)
+			{
+				lc::evaluate(ctx, expr, ctx.flags & ~(FLAG_TRACE | FLAG_FULL_TRACE));
+			}
+			else if(auto assertion = dynamic_cast<const Assert*>(expr); assertion != nullptr)
+			{
+				auto& check = checks.emplace_back();
+				expand(ctx, assertion, check);
+
+				check.where = zpr::sprint("{}:{}", path, i + 1);
+				check.line = line;
+
+				queue.push(&check);
+			}
+
+			delete expr;
+		}
+	}
+
+	int runChecks(Context& ctx, const std::vector<zbuf::str_view>& paths, int max_steps, int timeout_ms)
+	{
+		auto start = Clock::now();
+
+		size_t workers = std::max(1u, std::thread::hardware_concurrency());
+		auto queue = BoundedQueue<Check*>(4 * workers);
+
+		// a deque, so the workers' pointers stay valid while more checks are read.
+		std::deque<Check> checks;
+
+		std::vector<std::thread> threads;
+		for(size_t i = 0; i < workers; i++)
+		{
+			threads.emplace_back([&queue, max_steps, timeout_ms]() {
+				while(auto check = queue.pop())
+					run_check(*check, max_steps, timeout_ms);
+			});
+		}
+
+		size_t errors = 0;
+		for(auto path : paths)
+			read_checks(ctx, path, checks, queue, errors);
+
+		queue.close();
+		for(auto& t : threads)
+			t.join();
+
+		size_t passed = 0;
+		size_t failed = 0;
+		for(auto& check : checks)
+		{
+			print_check(&check, ctx.flags);
+
+			if(check.passed)        passed++;
+			else if(check.finished) failed++;
+		}
+
+		auto secs = std::chrono::duration<double>(Clock::now() - start).count();
+		zpr::println("\n{}*.{} {} check{}: {}{} passed{}, {}{} failed{}, {}{} over the limit{}, {}{} error{}{} ({} thread{}, {.2f} s)",
+			BLACK_BOLD, COLOUR_RESET, checks.size(), checks.size() == 1 ? "" : "s",
+			GREEN_BOLD, passed, COLOUR_RESET, RED_BOLD, failed, COLOUR_RESET,
+			YELLOW_BOLD, checks.size() - passed - failed, COLOUR_RESET, RED_BOLD, errors, errors == 1 ? "" : "s",
+			COLOUR_RESET, workers, workers == 1 ? "" : "s", secs);
+
+		// like --batch, the profile covers the whole run.
+		lc::reportProfile();
+
+		// a file that couldn't be read (or a line that couldn't be parsed) might have had checks in it.
+		return (passed == checks.size() && errors == 0) ? 0 : 1;
+	}
+}
@@ -3,6 +3,9 @@
 // Licensed under the Apache License Version 2.0.
 
 #include <set>
+#include <mutex>
+#include <algorithm>
+#include <climits>
 
 #include "ast.h"
 
@@ -11,18 +14,65 @@ namespace lc
 	using namespace ast;
 
 	std::vector<Expr**> find_substitutions(Expr** expr, const std::string& var);
-	Lambda* substitute(Lambda* expr, const std::vector<Expr**>& vars, const Expr* value);
+	Lambda* substitute(Lambda* expr, const std::vector<Expr**>& vars, Expr* value);
 	std::set<const Var*> find_free_variables(const Expr* expr);
 	std::map<std::string, Lambda*> find_bound_variables(Expr* expr);
+	std::set<std::string> find_free_names(const Expr* expr);
+	std::set<std::string> find_binder_names(const Expr* expr);
+	extern thread_local size_t renamed_nodes;
 	std::string fresh_name(const std::string& name);
 	Expr* replace_vars(const Context& ctx, const Expr* expr);
+	size_t hash_expr(const Expr* expr);
+	void splice_registers(const Context& ctx, Expr** expr);
+	void force(Expr* expr);
+	void force_all(Expr* expr);
+	void rename_binder(Lambda* l, const std::string& name, const std::string& fresh);
+	void find_binders(Expr* expr, const std::string& name, std::vector<Lambda*>& out);
+
+	// progress.cpp
+	void startProgress();
+	void stopProgress();
+	bool progressDue();
+	void reportProgress(int steps, const Expr* expr);
+
+	// profile.cpp
+	void startProfiling();
+	void stopProfiling();
+	bool pushOrigin(const std::string* origin);
+	void popOrigin();
+
+	// incremental.cpp
+	void reuse_normal_forms(Context& ctx, Expr** expr, int print_flags);
+	void remember_normal_form(Context& ctx, Expr* term, Expr* normal, int print_flags);
 
 	static Expr* eval(int& step, int print_flags, Expr** whole, Expr** expr);
 
 	bool alpha_equivalent(const Expr* a, const Expr* b);
+	bool identical(const Expr* a, const Expr* b);
 	Expr* alpha_conversion(Expr* lam, std::string var, const std::string& fresh);
 	Expr* beta_reduction(int& step, int print_flags, Expr** whole, Apply* app, Expr** parent);
 
+	// while the evaluator is inside a node that came from a definition, that definition is on
+	// the profiler's stack.
+	namespace {
+		struct OriginScope
+		{
+			OriginScope(int print_flags, const Expr* e)
+			{
+				if((print_flags & FLAG_PROFILE) && e->origin != nullptr)
+					this->pushed = pushOrigin(e->origin);
+			}
+
+			~OriginScope()
+			{
+				if(this->pushed)
+					popOrigin();
+			}
+
+			bool pushed = false;
+		};
+	}
+
 	template <typename Fn, typename PrinterFn, typename... Args>
 	static void do_transform(int print_flags, Fn&& fn, PrinterFn&& printer, Args&&... args)
 	{
@@ -43,11 +93,20 @@ namespace lc
 		}
 	}
 
+	// arguments that are callable only get called if we're actually tracing, so that
+	// printing (potentially huge) terms doesn't cost anything otherwise.
+	template <typename T>
+	static decltype(auto) trace_arg(T&& x)
+	{
+		if constexpr (std::is_invocable_v<T>)   return x();
+		else                                    return static_cast<T&&>(x);
+	}
+
 	template <typename... Args>
 	static void print_trace(int print_flags, const char* fmt, Args&&... args)
 	{
 		if(print_flags & FLAG_TRACE)
-			zpr::println(fmt, static_cast<Args&&>(args)...);
+			zpr::println(fmt, trace_arg(static_cast<Args&&>(args))...);
 	}
 
 	Expr* evaluate(Context& ctx, const Expr* expr, int print_flags)
@@ -68,25 +127,110 @@ namespace lc
 
 		// this also makes a clone.
 		auto copy = replace_vars(ctx, expr);
-		print_trace(print_flags, "{}0.{} {}", BLACK_BOLD, COLOUR_RESET, lc::print(copy, print_flags));
+		splice_registers(ctx, &copy);
+
+		if(!(print_flags & FLAG_INCREMENTAL))
+			return reduce(copy, print_flags);
+
+		auto input = copy->clone();
+		reuse_normal_forms(ctx, &copy, print_flags);
+
+		auto ret = reduce(copy, print_flags);
+		remember_normal_form(ctx, input, ret->clone(), print_flags);
+
+		return ret;
+	}
+
+	Expr* reduce(Expr* expr, int print_flags)
+	{
+		int steps = 0;
+		reduce(&expr, print_flags, INT_MAX, steps);
+
+		// nothing outside the evaluator knows about suspended renamings.
+		if((print_flags & FLAG_LAZY_RENAME) && expr != nullptr)
+			force_all(expr);
+
+		return expr;
+	}
+
+	bool reduce(Expr** expr, int print_flags, int max_steps, int& steps)
+	{
+		print_trace(print_flags, "{}0.{} {}", BLACK_BOLD, COLOUR_RESET, [&]() {
+			return lc::print(*expr, print_flags);
+		});
+
+		bool meter = (print_flags & FLAG_PROGRESS);
+		if(meter)
+			startProgress();
+
+		if(print_flags & FLAG_PROFILE)
+			startProfiling();
 
 		int step = 1;
-		while(copy)
+		bool finished = true;
+
+		while(*expr)
 		{
-			auto next = eval(step, print_flags, &copy, &copy);
+			if(step > max_steps)
+			{
+				finished = false;
+				break;
+			}
+
+			if(meter && progressDue())
+				reportProgress(step - 1, *expr);
+
+			auto next = eval(step, print_flags, expr, expr);
 			if(next == nullptr)
 				break;
 
-			copy = next;
+			*expr = next;
+		}
+
+		if(meter)
+			stopProgress();
+
+		if(print_flags & FLAG_PROFILE)
+			stopProfiling();
+
+		if(finished)
+			print_trace(print_flags, "{}*.{} {}done.{}", BLACK_BOLD, COLOUR_RESET, BLUE_BOLD, COLOUR_RESET);
+
+		steps = step - 1;
+		return finished;
+	}
+
+	std::vector<Expr*> evaluateBatch(Context& ctx, const Expr* fn, const std::vector<const Expr*>& inputs,
+		int print_flags)
+	{
+		// every lane runs the same function, so expand it exactly once. it is not normalised
+		// first: `fn` might not have a normal form even when `fn input` does (eg. if it ignores
+		// a diverging part), so each lane reduces its own application from scratch.
+		auto func = replace_vars(ctx, fn);
+		splice_registers(ctx, &func);
+
+		std::vector<Expr*> ret;
+		ret.reserve(inputs.size());
+
+		for(auto input : inputs)
+		{
+			Expr* call = new Apply(fn->loc, func->clone(), replace_vars(ctx, input));
+			splice_registers(ctx, &call);
+
+			ret.push_back(reduce(call, print_flags));
 		}
 
-		print_trace(print_flags, "{}*.{} {}done.{}", BLACK_BOLD, COLOUR_RESET, BLUE_BOLD, COLOUR_RESET);
-		return copy;
+		delete func;
+		return ret;
 	}
 
 	static Expr* eval(int& step, int print_flags, Expr** whole, Expr** expr)
 	{
 		assert(expr);
+		force(*expr);
+
+		OriginScope scope(print_flags, *expr);
+
 		if(auto a = dynamic_cast<Apply*>(*expr); a != nullptr)
 		{
 			return beta_reduction(step, print_flags, whole, a, expr);
@@ -110,47 +254,345 @@ namespace lc
 		}
 	}
 
-	Expr* beta_reduction(int& step, int print_flags, Expr** whole, Apply* app, Expr** parent)
+	constexpr size_t MAX_MEMO_ENTRIES   = 4096;
+
+	// the tables are shared by every copy of the function, including the ones being reduced
+	// on other threads by --batch and --check; the lock is not held while computing a result.
+	static std::mutex memo_lock;
+
+	static Expr* beta_reduction(int& step, int print_flags, Expr** whole, Apply* app, Expr** parent, bool head, bool top);
+
+	bool reduce_application(Expr** expr, int print_flags, bool head, int max_steps, int& steps)
+	{
+		int step = 1;
+		while(auto a = dynamic_cast<Apply*>(*expr))
+		{
+			if(step > max_steps)
+			{
+				steps = step - 1;
+				return false;
+			}
+
+			auto next = beta_reduction(step, print_flags, expr, a, expr, head, /* top: */ false);
+			if(next == nullptr)
+				break;
+
+			*expr = next;
+		}
+
+		steps = step - 1;
+		return true;
+	}
+
+	// a memoised call is reduced exactly as far as the evaluator would have reduced it in place, so
+	// that it never changes a result. if `top`, the call is only under lambdas, and the evaluator
+	// would normalise it completely. anywhere else (eg. in the argument of `v`, or applied to more
+	// arguments), it stops as soon as the call is no longer an application that can be reduced.
+	static Expr* memoised_reduction(int& step, int print_flags, Apply* app, Expr** parent, bool head, bool top)
+	{
+		auto func = dynamic_cast<Lambda*>(app->fn);
+		auto table = func->memo;
+
+		// the call gets evaluated eagerly, which might never finish if the argument is symbolic
+		// (eg. when reducing under a lambda); those are left to the normal path.
+		if(!find_free_variables(func).empty() || !find_free_variables(app->arg).empty())
+			return nullptr;
+
+		// hashing looks at names, so they have to be up to date. the argument is not reduced
+		// first, since the evaluator might not have reduced it either.
+		force_all(func);
+		force_all(app->arg);
+
+		auto key = (hash_expr(func) * 31 + hash_expr(app->arg)) * 2 + (top ? 1 : 0);
+
+		Expr* result = nullptr;
+		{
+			// different calls can have the same hash, so make sure it's actually this one. calls that
+			// are only alpha-equivalent would give a result with different names, so they don't count.
+			std::lock_guard<std::mutex> lk(memo_lock);
+			if(auto it = table->results.find(key); it != table->results.end()
+				&& identical(it->second.func, func) && identical(it->second.arg, app->arg))
+			{
+				result = it->second.result->clone();
+			}
+		}
+
+		print_trace(print_flags, "{}{}.{} {}memo:{} {}{}{} <- {}{}", BLACK_BOLD, step++, COLOUR_RESET,
+			BLUE_BOLD, COLOUR_RESET, BLACK_BOLD, table->name, COLOUR_RESET, [&]() { return lc::print(app->arg, print_flags); },
+			result != nullptr ? " (cached)" : "");
+
+		if(result == nullptr)
+		{
+			// the copy is not memoised itself, or we'd end up right back here.
+			auto copy = func->clone();
+			copy->memo = nullptr;
+
+			auto flags = print_flags & ~(FLAG_TRACE | FLAG_FULL_TRACE | FLAG_PROGRESS);
+
+			Expr* call = new Apply(app->loc, copy, app->arg->clone());
+			if(top)
+			{
+				int steps = 0;
+				reduce(&call, flags, INT_MAX, steps);
+				step += steps;
+
+				if(flags & FLAG_LAZY_RENAME)
+					force_all(call);
+			}
+			else
+			{
+				int steps = 0;
+				reduce_application(&call, flags, head, INT_MAX, steps);
+				step += steps;
+
+				if(flags & FLAG_LAZY_RENAME)
+					force_all(call);
+			}
+
+			std::lock_guard<std::mutex> lk(memo_lock);
+			auto entry = MemoTable::Entry { func->clone(), app->arg->clone(), call->clone() };
+
+			if(auto it = table->results.find(key); it != table->results.end())
+			{
+				// either another thread got here first, or a hash collision; the newer one wins.
+				delete it->second.func;
+				delete it->second.arg;
+				delete it->second.result;
+				it->second = entry;
+			}
+			else
+			{
+				if(table->order.size() >= MAX_MEMO_ENTRIES)
+				{
+					auto& old = table->results[table->order.front()];
+					delete old.func;
+					delete old.arg;
+					delete old.result;
+
+					table->results.erase(table->order.front());
+					table->order.pop_front();
+				}
+
+				table->results[key] = entry;
+				table->order.push_back(key);
+			}
+
+			result = call;
+		}
+
+		*parent = result;
+		delete app;
+
+		return result;
+	}
+
+	// with FLAG_MULTI_BETA, a spine `f a1 ... an` whose head starts with k >= 2 binders has its first
+	// k arguments substituted in one step. the binders being consumed never need to be renamed, since
+	// the arguments don't end up underneath them. `app` must be the outermost application of the spine,
+	// which is walked once; the applications inside it are never tried on their own. returns what
+	// replaces `app`, or null if fewer than two arguments can be substituted.
+	static Expr* multi_beta_reduction(int& step, int print_flags, Expr** whole, Apply* app, Expr** parent)
+	{
+		// the spine, innermost application first.
+		std::vector<Apply*> apps;
+		Expr* head = app;
+		while(auto a = dynamic_cast<Apply*>(head))
+		{
+			apps.push_back(a);
+			force(a->fn);
+			head = a->fn;
+		}
+
+		std::reverse(apps.begin(), apps.end());
+		if(apps.size() < 2)
+			return nullptr;
+
+		// memoised functions have to be applied on their own, so the chain stops before one.
+		std::vector<Lambda*> funcs;
+		for(auto e = head; funcs.size() < apps.size(); e = funcs.back()->body)
+		{
+			force(e);
+			auto l = dynamic_cast<Lambda*>(e);
+			if(l == nullptr || l->memo != nullptr)
+				break;
+
+			funcs.push_back(l);
+		}
+
+		if(funcs.size() < 2)
+			return nullptr;
+
+		// if there are more arguments than binders, only the saturated part of the spine is
+		// reduced, and the rest of the spine stays where it is.
+		auto ret = (funcs.size() < apps.size()) ? static_cast<Expr*>(app) : nullptr;
+		if(ret != nullptr)
+		{
+			parent = &apps[funcs.size()]->fn;
+			app = apps[funcs.size() - 1];
+			apps.resize(funcs.size());
+		}
+
+		OriginScope inner(print_flags, head);
+
+		std::set<std::string> free;
+		for(auto a : apps)
+		{
+			auto names = find_free_names(a->arg);
+			free.insert(names.begin(), names.end());
+		}
+
+		// only the part of the body that stays behind can capture anything.
+		auto last = funcs.back();
+		for(auto& v : free)
+		{
+			if(find_binder_names(last->body).count(v) == 0)
+				continue;
+
+			std::vector<Lambda*> binders;
+			find_binders(last->body, v, binders);
+
+			for(auto l : binders)
+			{
+				print_trace(print_flags, "{}{}.{} {}α-con:{} {}{}{} <- {}", BLACK_BOLD, step++, COLOUR_RESET,
+					GREEN, COLOUR_RESET, BLACK_BOLD, v, COLOUR_RESET, fresh_name(v));
+
+				do_transform(print_flags, [&]() {
+					if(print_flags & FLAG_LAZY_RENAME)  rename_binder(l, v, fresh_name(v));
+					else                                alpha_conversion(l, v, fresh_name(v));
+				}, logAlphaConversion, const_cast<const Expr**>(whole), l, print_flags);
+			}
+		}
+
+		// every occurrence is found before anything is substituted, so that free variables of one
+		// argument are not mistaken for occurrences of a later binder. if a binder is shadowed by a
+		// later one with the same name, its argument is unused.
+		std::vector<std::vector<Expr**>> substs(funcs.size());
+		for(size_t i = 0; i < funcs.size(); i++)
+		{
+			if(std::none_of(funcs.begin() + i + 1, funcs.end(), [&](auto l) { return l->arg == funcs[i]->arg; }))
+				substs[i] = find_substitutions(&last->body, funcs[i]->arg);
+		}
+
+		print_trace(print_flags, "{}{}.{} {}β-red:{} {}", BLACK_BOLD, step++, COLOUR_RESET, YELLOW, COLOUR_RESET, [&]() {
+			std::string ret;
+			for(size_t i = 0; i < funcs.size(); i++)
+			{
+				ret += zpr::sprint("{}{}{}{} <- {}", i > 0 ? ", " : "", BLACK_BOLD, funcs[i]->arg, COLOUR_RESET,
+					lc::print(apps[i]->arg, print_flags));
+			}
+
+			return ret;
+		});
+
+		std::vector<const Expr*> fns(funcs.begin(), funcs.end());
+		std::vector<const Expr*> args;
+		std::vector<Expr**> all_substs;
+		for(size_t i = 0; i < funcs.size(); i++)
+		{
+			args.push_back(apps[i]->arg);
+			all_substs.insert(all_substs.end(), substs[i].begin(), substs[i].end());
+		}
+
+		do_transform(print_flags, [&]() {
+			// the arguments are owned by the substitution now.
+			for(size_t i = 0; i < funcs.size(); i++)
+			{
+				substitute(last, substs[i], apps[i]->arg);
+				apps[i]->arg = nullptr;
+			}
+
+			*parent = last->body;
+		}, logSpineReduction, const_cast<const Expr**>(whole), fns, args, all_substs, print_flags);
+
+		// the outermost application owns the rest of the spine, and the lambdas.
+		auto body = last->body;
+		last->body = nullptr;
+		delete app;
+
+		return ret != nullptr ? ret : body;
+	}
+
+	// `head` is false when `app` is the function of another application, ie. not the top of its spine.
+	// `top` is true when `app` is only under lambdas, so it will be reduced to a normal form.
+	static Expr* beta_reduction(int& step, int print_flags, Expr** whole, Apply* app, Expr** parent, bool head, bool top)
 	{
+		force(app);
+		force(app->fn);
+
+		OriginScope scope(print_flags, app);
+		if(head && (print_flags & FLAG_MULTI_BETA))
+		{
+			if(auto ret = multi_beta_reduction(step, print_flags, whole, app, parent); ret != nullptr)
+				return ret;
+		}
+
 		if(auto func = dynamic_cast<Lambda*>(app->fn); func != nullptr)
 		{
+			// the redex belongs to whichever definition the function came from.
+			OriginScope inner(print_flags, func);
+
+			if(func->memo != nullptr)
+			{
+				if(auto ret = memoised_reduction(step, print_flags, app, parent, head, top); ret != nullptr)
+					return ret;
+			}
+
 			// get the free variables of the argument, and the bound variables of the function
-			auto free = find_free_variables(app->arg);
-			auto bound = find_bound_variables(func);
+			auto free = find_free_names(app->arg);
+			auto bound = find_binder_names(func);
 
 			// rename (alpha-convert) the target function (or any part of its body)
 			// if there is a name conflict
-			for(auto v : free)
+			for(auto& f : free)
 			{
-				auto f = v->name;
-				if(auto it = bound.find(f); it != bound.end())
+				if(bound.find(f) == bound.end())
+					continue;
+
+				// sibling binders with the same name are renamed separately. renaming one doesn't
+				// touch the others, so they can all be found at once.
+				std::vector<Lambda*> binders;
+				find_binders(func, f, binders);
+
+				for(auto l : binders)
 				{
 					print_trace(print_flags, "{}{}.{} {}α-con:{} {}{}{} <- {}", BLACK_BOLD, step++, COLOUR_RESET,
 						GREEN, COLOUR_RESET, BLACK_BOLD, f, COLOUR_RESET, fresh_name(f));
 
 					do_transform(print_flags, [&]() {
-						alpha_conversion(it->second, f, fresh_name(f));
-					}, logAlphaConversion, const_cast<const Expr**>(whole), it->second, print_flags);
+						if(print_flags & FLAG_LAZY_RENAME)  rename_binder(l, f, fresh_name(f));
+						else                                alpha_conversion(l, f, fresh_name(f));
+					}, logAlphaConversion, const_cast<const Expr**>(whole), l, print_flags);
 				}
+
+				// the new names might clash with the next free variable.
+				bound = find_binder_names(func);
 			}
 
 			// find the substitutions first so we can highlight them
 			auto substs = find_substitutions(&func->body, func->arg);
 
 			print_trace(print_flags, "{}{}.{} {}β-red:{} {}{}{} <- {}", BLACK_BOLD, step++, COLOUR_RESET,
-				YELLOW, COLOUR_RESET, BLACK_BOLD, func->arg, COLOUR_RESET, lc::print(app->arg, print_flags));
+				YELLOW, COLOUR_RESET, BLACK_BOLD, func->arg, COLOUR_RESET, [&]() { return lc::print(app->arg, print_flags); });
 
 			Lambda* ret = nullptr;
 			do_transform(print_flags, [&]() {
+				// the argument is owned by the substitution now.
 				ret = substitute(func, substs, app->arg);
+				app->arg = nullptr;
 				*parent = ret->body;
 			}, logBetaReduction, const_cast<const Expr**>(whole), func, app->arg, substs, print_flags);
 
-			return ret->body;
+			// the body has been spliced into the parent, so detach it
+			// and free the shells of the application and the lambda.
+			auto body = ret->body;
+			ret->body = nullptr;
+			delete app;
+
+			return body;
 		}
 		else if(auto a = dynamic_cast<Apply*>(app->fn); a != nullptr)
 		{
-			if(auto red = beta_reduction(step, print_flags, whole, a, &app->fn); red != nullptr)
+			if(auto red = beta_reduction(step, print_flags, whole, a, &app->fn, false, false); red != nullptr)
 			{
 				app->fn = red;
 				return app;
@@ -158,7 +600,7 @@ namespace lc
 		}
 		else if(auto a = dynamic_cast<Apply*>(app->arg); a != nullptr)
 		{
-			if(auto red = beta_reduction(step, print_flags, whole, a, &app->arg); red != nullptr)
+			if(auto red = beta_reduction(step, print_flags, whole, a, &app->arg, true, false); red != nullptr)
 			{
 				app->arg = red;
 				return app;
@@ -168,12 +610,20 @@ namespace lc
 		return nullptr;
 	}
 
+	Expr* beta_reduction(int& step, int print_flags, Expr** whole, Apply* app, Expr** parent)
+	{
+		return beta_reduction(step, print_flags, whole, app, parent, true, true);
+	}
+
 	Expr* alpha_conversion(Expr* e, std::string name, const std::string& fresh)
 	{
+		renamed_nodes++;
 		if(auto v = dynamic_cast<Var*>(e); v != nullptr)
 		{
-			if(v->name == name) return new Var(v->loc, fresh);
-			else                return v;
+			if(v->name == name)
+				v->name = fresh;
+
+			return v;
 		}
 		else if(auto a = dynamic_cast<Apply*>(e); a != nullptr)
 		{
@@ -188,7 +638,7 @@ namespace lc
 			{
 				auto fresher = fresh_name(fresh);
 				l->arg = fresher;
-				l->body = alpha_conversion(l->body, fresh, fresher);
+				l->body = alpha_conversion(alpha_conversion(l->body, fresh, fresher), name, fresh);
 			}
 			else
 			{
@@ -229,29 +679,49 @@ namespace lc
 namespace ast
 {
 	// expressions own their subs.
-	Expr::~Expr()     { }
+	Expr::~Expr()     { delete this->renames; }
 	Var::~Var()       { }
 	Let::~Let()       { delete this->value; }
 	Apply::~Apply()   { delete this->fn; delete this->arg; }
 	Lambda::~Lambda() { delete this->body; }
+	Assert::~Assert() { delete this->expr; delete this->expected; }
+
+	// clones keep the origin, and any renamings that haven't been applied yet.
+	template <typename T>
+	static T* copy_info(const Expr* from, T* to)
+	{
+		to->origin = from->origin;
+		if(from->renames != nullptr)
+			to->renames = new std::vector<std::pair<std::string, std::string>>(*from->renames);
+
+		return to;
+	}
 
 	Var* Var::clone() const
 	{
-		return new Var(this->loc, this->name);
+		return copy_info(this, new Var(this->loc, this->name));
 	}
 
 	Apply* Apply::clone() const
 	{
-		return new Apply(this->loc, this->fn->clone(), this->arg->clone());
+		return copy_info(this, new Apply(this->loc, this->fn->clone(), this->arg->clone()));
 	}
 
 	Lambda* Lambda::clone() const
 	{
-		return new Lambda(this->loc, this->argloc, this->arg, this->body->clone());
+		auto ret = new Lambda(this->loc, this->argloc, this->arg, this->body->clone());
+		ret->memo = this->memo;
+
+		return copy_info(this, ret);
 	}
 
 	Let* Let::clone() const
 	{
 		return new Let(this->loc, this->name, this->value->clone());
 	}
+
+	Assert* Assert::clone() const
+	{
+		return new Assert(this->loc, this->expr->clone(), this->expected->clone());
+	}
 }
@@ -11,7 +11,7 @@
 
 static std::vector<zbuf::str_view> split_string(zbuf::str_view view);
 static zst::Result<zbuf::str_view, std::string> read_file_raw(zbuf::str_view path);
-static zst::Result<std::vector<zbuf::str_view>, std::string> read_file_lines(zbuf::str_view path);
+zst::Result<std::vector<zbuf::str_view>, std::string> read_file_lines(zbuf::str_view path);
 
 namespace lc
 {
@@ -52,7 +52,15 @@ namespace lc
 				return;
 			}
 
-			lc::evaluate(ctx, expr_or_err.unwrap(), ctx.flags);
+			// results of plain expressions aren't kept anywhere, so don't leak them.
+			auto expr = expr_or_err.unwrap();
+			if(expr->type == ast::EXPR_ASSERT)
+				lc::checkAssertion(ctx, expr, ctx.flags);
+
+			else if(auto ret = lc::evaluate(ctx, expr, ctx.flags); expr->type != ast::EXPR_LET)
+				delete ret;
+
+			delete expr;
 		}
 
 		zpr::println("{}*.{} loaded {} line{} from '{}'", BLACK_BOLD, COLOUR_RESET, lines.size(),
@@ -136,7 +144,7 @@ static std::vector<zbuf::str_view> split_string(zbuf::str_view view)
 	return ret;
 }
 
-static zst::Result<std::vector<zbuf::str_view>, std::string> read_file_lines(zbuf::str_view path)
+zst::Result<std::vector<zbuf::str_view>, std::string> read_file_lines(zbuf::str_view path)
 {
 	auto file = read_file_raw(path);
 	if(!file) return zst::Err(file.error());
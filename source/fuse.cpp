@@ -0,0 +1,380 @@
+// fuse.cpp
+// Copyright (c) 2021, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "ast.h"
+#include "defs.h"
+
+#include <set>
+#include <algorithm>
+
+namespace lc
+{
+	using namespace ast;
+
+	// util.cpp
+	bool alpha_equivalent(const Expr* a, const Expr* b);
+	std::set<const Var*> find_free_variables(const Expr* expr);
+	std::string fresh_name(const std::string& name);
+
+	// lists are church-encoded as their own right fold (see lib/list.lc), so `map f (filter p xs)`
+	// builds a list out of `xs`, and then another one out of that. with FLAG_FUSION, pipelines of
+	// map and filter are turned into a single fold over `xs` before the names are expanded, so the
+	// intermediate lists never exist -- ie. foldr/build fusion, except that every list is a build.
+	namespace {
+		enum class Kind { None, Foldr, Map, Filter, Fold };
+
+		struct Role
+		{
+			Kind kind = Kind::None;
+
+			// for Fold, a definition of the form `foldr k z` (or `\l -> foldr k z l`).
+			const Expr* k = nullptr;
+			const Expr* z = nullptr;
+		};
+
+		struct Stage
+		{
+			Kind kind;
+			const Expr* fn;
+		};
+
+		struct Fuser
+		{
+			Fuser(const Context& ctx) : ctx(ctx) { }
+
+			const Context& ctx;
+			std::map<std::string, Role> roles;
+
+			// binders enclosing the current subterm, which hide definitions with the same name.
+			std::vector<const std::string*> bound;
+			bool changed = false;
+		};
+	}
+
+	// a name is only recognised if its definition is alpha-equivalent to one of these.
+	static const std::vector<std::pair<Kind, Expr*>>& library()
+	{
+		static auto defs = []() {
+			std::vector<std::pair<Kind, Expr*>> ret;
+			auto add = [&ret](Kind kind, const char* src) {
+				ret.emplace_back(kind, parser::parse(zbuf::str_view(src)).unwrap());
+			};
+
+			add(Kind::Foldr,  "\\k z l -> l k z");
+			add(Kind::Map,    "\\f l c n -> l (\\x r -> c (f x) r) n");
+			add(Kind::Filter, "\\p l c n -> l (\\x r -> p x (c x r) r) n");
+
+			return ret;
+		}();
+
+		return defs;
+	}
+
+	static const Expr* spine(const Expr* expr, std::vector<const Expr*>& args)
+	{
+		while(auto a = dynamic_cast<const Apply*>(expr))
+		{
+			args.insert(args.begin(), a->arg);
+			expr = a->fn;
+		}
+
+		return expr;
+	}
+
+	static bool is_bound(const Fuser& fs, const std::string& name)
+	{
+		return std::find_if(fs.bound.begin(), fs.bound.end(), [&](auto b) { return *b == name; }) != fs.bound.end();
+	}
+
+	static Role find_role(Fuser& fs, const std::string& name, int depth = 0);
+
+	static Role classify(Fuser& fs, const Expr* def, int depth)
+	{
+		// aliases (eg. `let fmap = map`) mean the same thing.
+		if(auto v = dynamic_cast<const Var*>(def); v != nullptr)
+			return find_role(fs, v->name, depth + 1);
+
+		for(auto& [ kind, canon ] : library())
+		{
+			if(alpha_equivalent(def, canon))
+				return Role { kind };
+		}
+
+		// consumers, like `let sum = foldr plus 0`.
+		auto eta = dynamic_cast<const Lambda*>(def);
+		auto body = eta != nullptr ? eta->body : def;
+
+		std::vector<const Expr*> args;
+		auto head = dynamic_cast<const Var*>(spine(body, args));
+		if(head == nullptr || find_role(fs, head->name, depth + 1).kind != Kind::Foldr)
+			return { };
+
+		if(eta == nullptr && args.size() == 2)
+			return Role { Kind::Fold, args[0], args[1] };
+
+		if(eta != nullptr && args.size() == 3)
+		{
+			auto l = dynamic_cast<const Var*>(args[2]);
+			auto uses = [&](const Expr* e) {
+				auto free = find_free_variables(e);
+				return std::any_of(free.begin(), free.end(), [&](auto v) { return v->name == eta->arg; });
+			};
+
+			if(l != nullptr && l->name == eta->arg && !uses(args[0]) && !uses(args[1]))
+				return Role { Kind::Fold, args[0], args[1] };
+		}
+
+		return { };
+	}
+
+	static Role find_role(Fuser& fs, const std::string& name, int depth)
+	{
+		// alias loops would never finish expanding anyway.
+		if(depth > 16)
+			return { };
+
+		if(auto it = fs.roles.find(name); it != fs.roles.end())
+			return it->second;
+
+		auto it = fs.ctx.vars.find(name);
+		auto role = it == fs.ctx.vars.end() ? Role { } : classify(fs, it->second, depth);
+
+		fs.roles[name] = role;
+		return role;
+	}
+
+	// the role of `expr` if it's the head of an application spine, here.
+	static Role role_at(Fuser& fs, const Expr* expr)
+	{
+		auto v = dynamic_cast<const Var*>(expr);
+		if(v == nullptr || is_bound(fs, v->name))
+			return { };
+
+		return find_role(fs, v->name);
+	}
+
+	// peels `map f` and `filter p` off of a list, outermost first, and returns what's left.
+	static const Expr* find_stages(Fuser& fs, const Expr* list, std::vector<Stage>& stages)
+	{
+		while(true)
+		{
+			std::vector<const Expr*> args;
+			auto kind = role_at(fs, spine(list, args)).kind;
+			if((kind != Kind::Map && kind != Kind::Filter) || args.size() != 2)
+				return list;
+
+			stages.push_back(Stage { kind, args[0] });
+			list = args[1];
+		}
+	}
+
+	static void find_names(const Expr* expr, std::set<std::string>& names)
+	{
+		if(auto v = dynamic_cast<const Var*>(expr); v != nullptr)
+		{
+			names.insert(v->name);
+		}
+		else if(auto a = dynamic_cast<const Apply*>(expr); a != nullptr)
+		{
+			find_names(a->fn, names);
+			find_names(a->arg, names);
+		}
+		else if(auto l = dynamic_cast<const Lambda*>(expr); l != nullptr)
+		{
+			names.insert(l->arg);
+			find_names(l->body, names);
+		}
+	}
+
+	static std::string unused_name(std::string name, std::set<std::string>& names)
+	{
+		while(names.find(name) != names.end())
+			name = fresh_name(name);
+
+		names.insert(name);
+		return name;
+	}
+
+	static Expr* fuse(Fuser& fs, const Expr* expr);
+
+	// `list` (after its stages) is folded with `k` and `z`; if `k` is null, the result is a list
+	// instead, ie. `\c n -> ...`. returns null if there's nothing to fuse.
+	static Expr* fuse_pipeline(Fuser& fs, const Expr* site, const Expr* k, const Expr* z, const Expr* list)
+	{
+		std::vector<Stage> stages;
+		auto source = find_stages(fs, list, stages);
+
+		// a single map or filter on its own doesn't make a list that anything else consumes.
+		if(stages.size() < (k != nullptr ? 1 : 2))
+			return nullptr;
+
+		fs.changed = true;
+
+		auto mk_var = [site](const std::string& name) -> Expr* {
+			auto ret = new Var(site->loc, name);
+			ret->origin = site->origin;
+			return ret;
+		};
+
+		auto mk_apply = [site](Expr* fn, Expr* arg) -> Expr* {
+			auto ret = new Apply(site->loc, fn, arg);
+			ret->origin = site->origin;
+			return ret;
+		};
+
+		auto mk_lambda = [site](const std::string& arg, Expr* body) -> Expr* {
+			auto ret = new Lambda(site->loc, site->loc, arg, body);
+			ret->origin = site->origin;
+			return ret;
+		};
+
+		// everything that ends up under a new binder is fused first, so we can pick names that
+		// don't capture anything in it.
+		std::vector<Expr*> fns;
+		for(auto& s : stages)
+			fns.push_back(fuse(fs, s.fn));
+
+		auto folder = k != nullptr ? fuse(fs, k) : nullptr;
+		auto init = z != nullptr ? fuse(fs, z) : nullptr;
+		auto from = fuse(fs, source);
+
+		std::set<std::string> names;
+		for(auto f : fns)
+			find_names(f, names);
+
+		find_names(from, names);
+		if(folder != nullptr)   find_names(folder, names);
+		if(init != nullptr)     find_names(init, names);
+
+		std::string c, n;
+		if(folder == nullptr)
+		{
+			c = unused_name("c", names);
+			n = unused_name("n", names);
+		}
+
+		auto x = unused_name("x", names);
+		auto r = unused_name("r", names);
+
+		// what happens to an element `e` (with the rest of the fold `r`): it goes through the
+		// innermost stage first, and reaches the folding function last.
+		std::function<Expr* (Expr*, Expr*)> emit = [&](Expr* e, Expr* rest) {
+			return mk_apply(mk_apply(folder != nullptr ? folder->clone() : mk_var(c), e), rest);
+		};
+
+		for(size_t i = 0; i < stages.size(); i++)
+		{
+			auto f = fns[i];
+			if(stages[i].kind == Kind::Map)
+			{
+				emit = [&mk_apply, f, next = std::move(emit)](Expr* e, Expr* rest) {
+					return next(mk_apply(f->clone(), e), rest);
+				};
+			}
+			else
+			{
+				emit = [&mk_apply, f, next = std::move(emit)](Expr* e, Expr* rest) {
+					auto kept = next(e->clone(), rest->clone());
+					return mk_apply(mk_apply(mk_apply(f->clone(), e), kept), rest);
+				};
+			}
+		}
+
+		auto step = mk_lambda(x, mk_lambda(r, emit(mk_var(x), mk_var(r))));
+
+		Expr* ret = nullptr;
+		if(folder != nullptr)   ret = mk_apply(mk_apply(from, step), init);
+		else                    ret = mk_lambda(c, mk_lambda(n, mk_apply(mk_apply(from, step), mk_var(n))));
+
+		for(auto f : fns)
+			delete f;
+
+		delete folder;
+		return ret;
+	}
+
+	// `foldr k z list`, or `consumer list`.
+	static Expr* fuse_fold(Fuser& fs, const Expr* expr)
+	{
+		std::vector<const Expr*> args;
+		auto role = role_at(fs, spine(expr, args));
+
+		if(role.kind == Kind::Foldr && args.size() == 3)
+			return fuse_pipeline(fs, expr, args[0], args[1], args[2]);
+
+		if(role.kind == Kind::Fold && args.size() == 1)
+		{
+			// the folding function comes from the definition, so nothing here can be allowed
+			// to capture its free variables.
+			auto free = find_free_variables(role.k);
+			auto tmp = find_free_variables(role.z);
+			free.insert(tmp.begin(), tmp.end());
+
+			if(std::any_of(free.begin(), free.end(), [&](auto v) { return is_bound(fs, v->name); }))
+				return nullptr;
+
+			return fuse_pipeline(fs, expr, role.k, role.z, args[0]);
+		}
+
+		return nullptr;
+	}
+
+	static Expr* fuse(Fuser& fs, const Expr* expr)
+	{
+		if(auto ret = fuse_fold(fs, expr); ret != nullptr)
+			return ret;
+
+		if(auto ret = fuse_pipeline(fs, expr, nullptr, nullptr, expr); ret != nullptr)
+			return ret;
+
+		if(auto a = dynamic_cast<const Apply*>(expr); a != nullptr)
+		{
+			auto ret = new Apply(a->loc, fuse(fs, a->fn), fuse(fs, a->arg));
+			ret->origin = a->origin;
+
+			return ret;
+		}
+		else if(auto l = dynamic_cast<const Lambda*>(expr); l != nullptr)
+		{
+			fs.bound.push_back(&l->arg);
+			auto ret = new Lambda(l->loc, l->argloc, l->arg, fuse(fs, l->body));
+			fs.bound.pop_back();
+
+			ret->memo = l->memo;
+			ret->origin = l->origin;
+
+			return ret;
+		}
+		else
+		{
+			return expr->clone();
+		}
+	}
+
+	// returns null if there was nothing to fuse.
+	Expr* fuse_lists(const Context& ctx, const Expr* expr)
+	{
+		auto fs = Fuser(ctx);
+
+		// every pipeline has a map or a filter in it, so don't copy the whole term unless
+		// something here refers to one.
+		auto free = find_free_variables(expr);
+		if(std::none_of(free.begin(), free.end(), [&](auto v) {
+			auto kind = find_role(fs, v->name).kind;
+			return kind == Kind::Map || kind == Kind::Filter;
+		}))
+		{
+			return nullptr;
+		}
+
+		auto ret = fuse(fs, expr);
+		if(!fs.changed)
+		{
+			delete ret;
+			return nullptr;
+		}
+
+		return ret;
+	}
+}
@@ -14,6 +14,9 @@ namespace lc
 	using namespace ast;
 	using parser::Location;
 
+	// util.cpp
+	void force(Expr* expr);
+
 	// constexpr const char* BLACK         = "\x1b[30m";
 	// constexpr const char* RED           = "\x1b[31m";
 	// constexpr const char* BLUE          = "\x1b[34m";
@@ -43,6 +46,9 @@ namespace lc
 	static void int_highlight(State& st, const Expr* expr, std::string& top, std::string& bot,
 		bool combine = false, bool omit_lambda_parens = false)
 	{
+		// printing doesn't change what the expression means, only how far its renamings got.
+		force(const_cast<Expr*>(expr));
+
 		bool pop = false;
 		bool match = false;
 
@@ -121,6 +127,8 @@ namespace lc
 				st.combined_args.insert(f->arg);
 
 			bool omit_next_parens = false;
+			force(f->body);
+
 			if(auto inner = dynamic_cast<Lambda*>(f->body); (st.flags & FLAG_ABBREV_LAMBDA) && inner)
 			{
 				// if an outer lambda already bound this argument, for disambiguity's sake
@@ -161,6 +169,12 @@ namespace lc
 
 			int_highlight(st, let->value, top, bot);
 		}
+		else if(auto as = dynamic_cast<const Assert*>(expr); as)
+		{
+			int_highlight(st, as->expr, top, bot);
+			add(" ==> ", repeat(5, " "));
+			int_highlight(st, as->expected, top, bot);
+		}
 		else
 		{
 			abort();
@@ -201,19 +215,28 @@ namespace lc
 	}
 
 	std::pair<std::string, std::string> logBetaReduction(const Expr** whole, const Expr* fn, const Expr* arg,
-		const std::vector<Expr**>& _substs, int print_flags)
+		const std::vector<Expr**>& substs, int print_flags)
+	{
+		return logSpineReduction(whole, { fn }, { arg }, substs, print_flags);
+	}
+
+	std::pair<std::string, std::string> logSpineReduction(const Expr** whole, const std::vector<const Expr*>& _fns,
+		const std::vector<const Expr*>& _args, const std::vector<Expr**>& _substs, int print_flags)
 	{
 		std::set<const Expr*> subs;
 		std::transform(_substs.begin(), _substs.end(), std::inserter(subs, subs.begin()),
 			[](auto x) { return *x; });
 
+		auto fns = std::set<const Expr*>(_fns.begin(), _fns.end());
+		auto args = std::set<const Expr*>(_args.begin(), _args.end());
+
 		return highlight(*whole, [&](const Expr* e) -> std::optional<std::string> {
-			if(e == arg)                        return BETA_ARG_HIGHLIGHT;
+			if(args.find(e) != args.end())      return BETA_ARG_HIGHLIGHT;
 			else if(subs.find(e) != subs.end()) return BETA_SUB_HIGHLIGHT;
 			else                                return std::nullopt;
 
 		}, [&](const Expr* l) -> std::optional<std::string> {
-			return (l == fn) ? BETA_VAR_HIGHLIGHT : std::optional<std::string>();
+			return (fns.find(l) != fns.end()) ? BETA_VAR_HIGHLIGHT : std::optional<std::string>();
 		}, print_flags);
 	}
 
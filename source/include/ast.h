@@ -35,6 +35,7 @@ namespace parser
 		LParen,
 		RParen,
 		RightArrow,
+		LongArrow,
 		Period,
 		Lambda,
 		Equal,
@@ -69,6 +70,7 @@ namespace ast
 	constexpr int EXPR_APPLY        = 2;
 	constexpr int EXPR_LAMBDA       = 3;
 	constexpr int EXPR_LET          = 4;
+	constexpr int EXPR_ASSERT       = 5;
 
 	struct Expr
 	{
@@ -80,6 +82,13 @@ namespace ast
 
 		const int type;
 		parser::Location loc;
+
+		// the name of the definition that this node was expanded from, if any; see replace_vars().
+		const std::string* origin = 0;
+
+		// renamings (from, to) that still have to be applied to this node and everything below it,
+		// in order; see force() in util.cpp. always null unless FLAG_LAZY_RENAME is used.
+		std::vector<std::pair<std::string, std::string>>* renames = 0;
 	};
 
 	struct Var : Expr
@@ -120,6 +129,9 @@ namespace ast
 		parser::Location argloc;
 		std::string arg;
 		Expr* body = 0;
+
+		// set (by ':memo') on the innermost lambda of a definition; copies share the table.
+		lc::MemoTable* memo = 0;
 	};
 
 	// it's not really an expression, but whatever.
@@ -136,4 +148,19 @@ namespace ast
 		std::string name;
 		Expr* value = 0;
 	};
+
+	// neither is this; `expr ==> expected` checks that both sides have alpha-equivalent normal forms.
+	struct Assert : Expr
+	{
+		Assert(parser::Location loc, Expr* expr, Expr* expected) : Expr(TYPE, loc),
+			expr(expr), expected(expected) { }
+
+		virtual ~Assert() override;
+		virtual Assert* clone() const override;
+
+		static constexpr int TYPE = EXPR_ASSERT;
+
+		Expr* expr = 0;
+		Expr* expected = 0;
+	};
 }
@@ -7,6 +7,8 @@
 #include "zbuf.h"
 
 #include <map>
+#include <set>
+#include <deque>
 #include <optional>
 #include <functional>
 #include <unordered_map>
@@ -22,14 +24,70 @@ namespace lc
 	constexpr int FLAG_TRACE            = 0x10;
 	constexpr int FLAG_FULL_TRACE       = 0x20;
 	constexpr int FLAG_VAR_REPLACEMENT  = 0x40;
+	constexpr int FLAG_INCREMENTAL      = 0x80;
+	constexpr int FLAG_PROGRESS         = 0x100;
+	constexpr int FLAG_PROFILE          = 0x200;
+	constexpr int FLAG_LAZY_RENAME      = 0x400;
+	constexpr int FLAG_MULTI_BETA       = 0x800;
+	constexpr int FLAG_FUSION           = 0x1000;
+
+	// results of calls to a function marked with ':memo', keyed by the alpha-invariant hash of the
+	// function (with any earlier arguments already applied) and of its normalised argument.
+	struct MemoTable
+	{
+		// the call is kept along with its result, since different calls can have the same hash.
+		struct Entry
+		{
+			ast::Expr* func = nullptr;
+			ast::Expr* arg = nullptr;
+			ast::Expr* result = nullptr;
+		};
+
+		std::string name;
+		std::unordered_map<size_t, Entry> results;
+		std::deque<size_t> order;
+	};
 
 	struct Context
 	{
 		int flags = 0;
 		std::map<std::string, const ast::Expr*> vars;
+
+		// previous results in the repl (or in --batch); `$1` is the first, and `it` is the last.
+		std::vector<const ast::Expr*> results;
+
+		// the lambdas of a memoised definition point at the table here; see memoise() in util.cpp.
+		std::map<std::string, MemoTable> memos;
+
+		// for FLAG_INCREMENTAL (see incremental.cpp): normal forms of closed terms that were
+		// reduced before, keyed by alpha-invariant hash, and the hashes of the closed subterms
+		// of the previous input. a null `normal` means it didn't normalise within the budget.
+		struct NormalForm
+		{
+			ast::Expr* term = nullptr;
+			ast::Expr* normal = nullptr;
+		};
+
+		std::unordered_map<size_t, NormalForm> normal_forms;
+		std::deque<size_t> normal_form_order;
+		std::set<size_t> last_subterms;
 	};
 
 	ast::Expr* evaluate(Context& vc, const ast::Expr* expr, int print_flags);
+	ast::Expr* reduce(ast::Expr* expr, int print_flags);
+	// with FLAG_LAZY_RENAME, this can leave renamings suspended in `expr`, so that reducing it in
+	// chunks doesn't keep forcing the whole term; use the other one for a finished result.
+	bool reduce(ast::Expr** expr, int print_flags, int max_steps, int& steps);
+
+	// reduces `expr` only while it is an application that can be reduced; that's as far as the
+	// evaluator goes with a term that isn't only underneath lambdas. `head` is false if the term is
+	// the function of another application (see multi_beta_reduction()).
+	bool reduce_application(ast::Expr** expr, int print_flags, bool head, int max_steps, int& steps);
+
+	// reduces `fn input` for each input in turn. only the expansion of `fn` is shared; the
+	// applications are reduced separately, exactly as if each had been typed on its own.
+	std::vector<ast::Expr*> evaluateBatch(Context& ctx, const ast::Expr* fn,
+		const std::vector<const ast::Expr*>& inputs, int print_flags);
 
 	std::pair<std::string, std::string> highlight(const ast::Expr* expr,
 		std::function<std::optional<std::string> (const ast::Expr*)> pred,
@@ -44,6 +102,10 @@ namespace lc
 	std::pair<std::string, std::string> logBetaReduction(const ast::Expr** whole, const ast::Expr* fn,
 		const ast::Expr* arg, const std::vector<ast::Expr**>& substs, int print_flags);
 
+	std::pair<std::string, std::string> logSpineReduction(const ast::Expr** whole,
+		const std::vector<const ast::Expr*>& fns, const std::vector<const ast::Expr*>& args,
+		const std::vector<ast::Expr**>& substs, int print_flags);
+
 	std::pair<std::string, std::string> logAlphaConversion(const ast::Expr** whole,
 		const ast::Expr* sub, int print_flags);
 
@@ -52,6 +114,15 @@ namespace lc
 	void repl(Context& ctx);
 	void loadFile(Context& ctx, zbuf::str_view path);
 	void evalLine(Context& ctx, zbuf::str_view sv);
+	void runBatch(Context& ctx, const std::vector<zbuf::str_view>& paths);
+	void reportProfile();
+
+	// limits for each `expr ==> expected`, shared between both sides.
+	constexpr int DEFAULT_CHECK_STEPS       = 10000000;
+	constexpr int DEFAULT_CHECK_TIMEOUT_MS  = 10000;
+
+	bool checkAssertion(Context& ctx, const ast::Expr* assertion, int print_flags);
+	int runChecks(Context& ctx, const std::vector<zbuf::str_view>& paths, int max_steps, int timeout_ms);
 
 	constexpr const char* COLOUR_RESET  = "\x1b[0m";
 	constexpr const char* YELLOW        = "\x1b[33m";
@@ -0,0 +1,62 @@
+// queue.h
+// Copyright (c) 2021, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <condition_variable>
+
+namespace lc
+{
+	// a blocking queue with a fixed capacity, for handing work between threads. push() blocks
+	// while the queue is full and pop() blocks while it is empty; once the queue is closed,
+	// pop() drains whatever is left and then returns nothing.
+	template <typename T>
+	struct BoundedQueue
+	{
+		explicit BoundedQueue(size_t capacity) : capacity(capacity) { }
+
+		void push(T item)
+		{
+			std::unique_lock<std::mutex> lk(this->lock);
+			this->not_full.wait(lk, [this]() { return this->items.size() < this->capacity; });
+
+			this->items.push_back(std::move(item));
+			this->not_empty.notify_one();
+		}
+
+		std::optional<T> pop()
+		{
+			std::unique_lock<std::mutex> lk(this->lock);
+			this->not_empty.wait(lk, [this]() { return this->closed || !this->items.empty(); });
+
+			if(this->items.empty())
+				return std::nullopt;
+
+			auto ret = std::move(this->items.front());
+			this->items.pop_front();
+
+			this->not_full.notify_one();
+			return ret;
+		}
+
+		void close()
+		{
+			std::lock_guard<std::mutex> lk(this->lock);
+			this->closed = true;
+			this->not_empty.notify_all();
+		}
+
+	private:
+		size_t capacity;
+		bool closed = false;
+
+		std::deque<T> items;
+		std::mutex lock;
+		std::condition_variable not_empty;
+		std::condition_variable not_full;
+	};
+}
@@ -0,0 +1,556 @@
+// store.h
+// Copyright (c) 2021, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+
+#include <set>
+#include <deque>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+#include "ast.h"
+
+// hashing and alpha-equivalence, written once against a "node store"; util.cpp uses them for
+// ast::Expr through the `Ast` store. there is also a small normal-order normaliser, but it is
+// only used by ':bench' to compare representations; evaluation and printing in the interpreter
+// still work on ast::Expr trees directly (see eval.cpp).
+//
+// a store has a `Ref` type (a handle to a node, compared with ==), and:
+//
+//   int kind(Ref)                      -- ast::EXPR_VAR, ast::EXPR_APPLY or ast::EXPR_LAMBDA
+//   const std::string& name(Ref)       -- of a variable
+//   const std::string& binder(Ref)     -- of a lambda
+//   Ref fn(Ref), arg(Ref), body(Ref)
+//
+//   Ref var(const std::string&)
+//   Ref apply(Ref fn, Ref arg)
+//   Ref lambda(const std::string& binder, Ref body)
+//
+//   size_t footprint()                 -- bytes used by all the nodes made so far
+//
+// nodes are immutable and may be shared, and stores only ever grow; compact() copies the
+// live part of a term into a new store. references returned by name() and binder() stay valid
+// until the store is destroyed.
+namespace lc::store
+{
+	using ast::EXPR_VAR;
+	using ast::EXPR_APPLY;
+	using ast::EXPR_LAMBDA;
+
+	// names are interned for the compact stores; a deque, so references to them stay valid.
+	struct NameTable
+	{
+		uint32_t intern(const std::string& name)
+		{
+			if(auto it = this->ids.find(name); it != this->ids.end())
+				return it->second;
+
+			this->names.push_back(name);
+			return this->ids[name] = (uint32_t) (this->names.size() - 1);
+		}
+
+		const std::string& get(uint32_t id) const { return this->names[id]; }
+
+	private:
+		std::deque<std::string> names;
+		std::unordered_map<std::string, uint32_t> ids;
+	};
+
+	// plain ast::Expr trees. building with this makes ordinary (owned) trees, so it's only right
+	// if every node is used exactly once, as in transfer(); it's for converting to and from the ast.
+	struct Ast
+	{
+		using Ref = const ast::Expr*;
+
+		int kind(Ref r) const                       { return r->type; }
+		const std::string& name(Ref r) const        { return static_cast<const ast::Var*>(r)->name; }
+		const std::string& binder(Ref r) const      { return static_cast<const ast::Lambda*>(r)->arg; }
+		Ref fn(Ref r) const                         { return static_cast<const ast::Apply*>(r)->fn; }
+		Ref arg(Ref r) const                        { return static_cast<const ast::Apply*>(r)->arg; }
+		Ref body(Ref r) const                       { return static_cast<const ast::Lambda*>(r)->body; }
+
+		Ref var(const std::string& name)                    { return new ast::Var({ }, name); }
+		Ref apply(Ref fn, Ref arg)                          { return new ast::Apply({ }, mut(fn), mut(arg)); }
+		Ref lambda(const std::string& binder, Ref body)     { return new ast::Lambda({ }, { }, binder, mut(body)); }
+
+	protected:
+		static ast::Expr* mut(Ref r) { return const_cast<ast::Expr*>(r); }
+	};
+
+	// the usual ast::Expr nodes, except that they are shared instead of owned.
+	struct Tree : Ast
+	{
+		Tree() = default;
+		Tree(const Tree&) = delete;
+		Tree& operator = (const Tree&) = delete;
+
+		Tree& operator = (Tree&& other)
+		{
+			std::swap(this->nodes, other.nodes);
+			std::swap(this->bytes, other.bytes);
+			return *this;
+		}
+
+		~Tree()
+		{
+			// the destructors would delete the (shared) children, so detach them first.
+			for(auto e : this->nodes)
+			{
+				if(auto a = dynamic_cast<ast::Apply*>(e); a != nullptr)
+					a->fn = nullptr, a->arg = nullptr;
+
+				else if(auto l = dynamic_cast<ast::Lambda*>(e); l != nullptr)
+					l->body = nullptr;
+
+				delete e;
+			}
+		}
+
+		Ref var(const std::string& name)                    { return this->add(Ast::var(name), sizeof(ast::Var)); }
+		Ref apply(Ref fn, Ref arg)                          { return this->add(Ast::apply(fn, arg), sizeof(ast::Apply)); }
+		Ref lambda(const std::string& binder, Ref body)     { return this->add(Ast::lambda(binder, body), sizeof(ast::Lambda)); }
+
+		size_t footprint() const { return this->bytes; }
+
+	private:
+		Ref add(Ref e, size_t size)
+		{
+			this->nodes.push_back(mut(e));
+			this->bytes += size;
+			return e;
+		}
+
+		std::vector<ast::Expr*> nodes;
+		size_t bytes = 0;
+	};
+
+	// fixed-size nodes in one array, linked by index.
+	struct Pool
+	{
+		using Ref = uint32_t;
+
+		int kind(Ref r) const                       { return this->nodes[r].kind; }
+		const std::string& name(Ref r) const        { return this->names.get(this->nodes[r].name); }
+		const std::string& binder(Ref r) const      { return this->names.get(this->nodes[r].name); }
+		Ref fn(Ref r) const                         { return this->nodes[r].a; }
+		Ref arg(Ref r) const                        { return this->nodes[r].b; }
+		Ref body(Ref r) const                       { return this->nodes[r].a; }
+
+		Ref var(const std::string& name)                    { return this->add({ EXPR_VAR, this->names.intern(name), 0, 0 }); }
+		Ref apply(Ref fn, Ref arg)                          { return this->add({ EXPR_APPLY, 0, fn, arg }); }
+		Ref lambda(const std::string& binder, Ref body)     { return this->add({ EXPR_LAMBDA, this->names.intern(binder), body, 0 }); }
+
+		size_t footprint() const { return this->nodes.size() * sizeof(Node); }
+
+	private:
+		struct Node
+		{
+			uint8_t kind;
+			uint32_t name;
+			Ref a;
+			Ref b;
+		};
+
+		Ref add(Node n) { this->nodes.push_back(n); return (Ref) (this->nodes.size() - 1); }
+
+		std::vector<Node> nodes;
+		NameTable names;
+	};
+
+	// prefix order in one array: each node is immediately followed by its children, and knows
+	// the length of its whole subterm, so the argument of an application is one jump away. the
+	// catch is that making a node copies its children after it.
+	struct Flat
+	{
+		using Ref = uint32_t;
+
+		int kind(Ref r) const                       { return this->cells[r].kind; }
+		const std::string& name(Ref r) const        { return this->names.get(this->cells[r].name); }
+		const std::string& binder(Ref r) const      { return this->names.get(this->cells[r].name); }
+		Ref fn(Ref r) const                         { return r + 1; }
+		Ref arg(Ref r) const                        { return r + 1 + this->cells[r + 1].length; }
+		Ref body(Ref r) const                       { return r + 1; }
+
+		Ref var(const std::string& name)
+		{
+			auto ret = (Ref) this->cells.size();
+			this->cells.push_back({ EXPR_VAR, this->names.intern(name), 1 });
+			return ret;
+		}
+
+		Ref apply(Ref fn, Ref arg)
+		{
+			auto ret = (Ref) this->cells.size();
+			this->cells.push_back({ EXPR_APPLY, 0, 1 + this->cells[fn].length + this->cells[arg].length });
+			this->copy(fn);
+			this->copy(arg);
+			return ret;
+		}
+
+		Ref lambda(const std::string& binder, Ref body)
+		{
+			auto ret = (Ref) this->cells.size();
+			this->cells.push_back({ EXPR_LAMBDA, this->names.intern(binder), 1 + this->cells[body].length });
+			this->copy(body);
+			return ret;
+		}
+
+		size_t footprint() const { return this->cells.size() * sizeof(Cell); }
+
+	private:
+		struct Cell
+		{
+			uint8_t kind;
+			uint32_t name;
+			uint32_t length;
+		};
+
+		void copy(Ref r)
+		{
+			auto n = this->cells[r].length;
+			for(uint32_t i = 0; i < n; i++)
+			{
+				auto c = this->cells[r + i];
+				this->cells.push_back(c);
+			}
+		}
+
+		std::vector<Cell> cells;
+		NameTable names;
+	};
+
+
+
+
+	template <typename S>
+	size_t size(const S& s, typename S::Ref r)
+	{
+		switch(s.kind(r))
+		{
+			case EXPR_APPLY:    return 1 + size(s, s.fn(r)) + size(s, s.arg(r));
+			case EXPR_LAMBDA:   return 1 + size(s, s.body(r));
+			default:            return 1;
+		}
+	}
+
+	template <typename S>
+	void free_variables(const S& s, typename S::Ref r, std::vector<const std::string*>& bound,
+		std::set<std::string>& out)
+	{
+		if(s.kind(r) == EXPR_VAR)
+		{
+			auto& n = s.name(r);
+			if(std::find_if(bound.begin(), bound.end(), [&n](auto b) { return *b == n; }) == bound.end())
+				out.insert(n);
+		}
+		else if(s.kind(r) == EXPR_APPLY)
+		{
+			free_variables(s, s.fn(r), bound, out);
+			free_variables(s, s.arg(r), bound, out);
+		}
+		else
+		{
+			bound.push_back(&s.binder(r));
+			free_variables(s, s.body(r), bound, out);
+			bound.pop_back();
+		}
+	}
+
+	template <typename S>
+	std::set<std::string> free_variables(const S& s, typename S::Ref r)
+	{
+		std::set<std::string> ret;
+		std::vector<const std::string*> bound;
+		free_variables(s, r, bound, ret);
+
+		return ret;
+	}
+
+	template <typename S>
+	bool is_free_in(const S& s, typename S::Ref r, const std::string& name)
+	{
+		switch(s.kind(r))
+		{
+			case EXPR_VAR:      return s.name(r) == name;
+			case EXPR_APPLY:    return is_free_in(s, s.fn(r), name) || is_free_in(s, s.arg(r), name);
+			default:            return s.binder(r) != name && is_free_in(s, s.body(r), name);
+		}
+	}
+
+	// bound variables hash by their de bruijn index and free ones by name, so alpha-equivalent terms
+	// hash the same. `need` is how many enclosing binders the term needs to be closed (SIZE_MAX if it
+	// has free variables); if `subterms` is given, { hash, need } is recorded for every node in it.
+	template <typename S>
+	size_t hash(const S& s, typename S::Ref r, std::vector<const std::string*>& bound, size_t& need,
+		std::unordered_map<typename S::Ref, std::pair<size_t, size_t>>* subterms = nullptr)
+	{
+		auto combine = [](size_t a, size_t b) -> size_t {
+			return a ^ (b + 0x9e3779b97f4a7c15 + (a << 6) + (a >> 2));
+		};
+
+		size_t ret = 0;
+		if(s.kind(r) == EXPR_VAR)
+		{
+			auto& n = s.name(r);
+			auto it = std::find_if(bound.rbegin(), bound.rend(), [&n](auto b) { return *b == n; });
+			if(it != bound.rend())
+			{
+				auto idx = (size_t) (it - bound.rbegin());
+				ret = combine(EXPR_VAR, idx);
+				need = idx + 1;
+			}
+			else
+			{
+				ret = combine(EXPR_VAR, std::hash<std::string>()(n));
+				need = SIZE_MAX;
+			}
+		}
+		else if(s.kind(r) == EXPR_APPLY)
+		{
+			size_t n1 = 0, n2 = 0;
+			ret = combine(EXPR_APPLY, hash(s, s.fn(r), bound, n1, subterms));
+			ret = combine(ret, hash(s, s.arg(r), bound, n2, subterms));
+			need = std::max(n1, n2);
+		}
+		else
+		{
+			bound.push_back(&s.binder(r));
+			ret = combine(EXPR_LAMBDA, hash(s, s.body(r), bound, need, subterms));
+			bound.pop_back();
+
+			if(need != SIZE_MAX && need > 0)
+				need -= 1;
+		}
+
+		if(subterms != nullptr)
+			subterms->emplace(r, std::make_pair(ret, need));
+
+		return ret;
+	}
+
+	template <typename S>
+	size_t hash(const S& s, typename S::Ref r)
+	{
+		size_t need = 0;
+		std::vector<const std::string*> bound;
+		return hash(s, r, bound, need);
+	}
+
+	template <typename S>
+	bool alpha_equivalent(const S& s, typename S::Ref a, typename S::Ref b, std::vector<const std::string*>& ba,
+		std::vector<const std::string*>& bb)
+	{
+		if(s.kind(a) != s.kind(b))
+			return false;
+
+		if(s.kind(a) == EXPR_VAR)
+		{
+			auto& na = s.name(a);
+			auto& nb = s.name(b);
+
+			// both have to be bound by the same binder (counting outwards), or be the same free variable.
+			auto ia = std::find_if(ba.rbegin(), ba.rend(), [&na](auto x) { return *x == na; });
+			auto ib = std::find_if(bb.rbegin(), bb.rend(), [&nb](auto x) { return *x == nb; });
+
+			if(ia == ba.rend() || ib == bb.rend())
+				return ia == ba.rend() && ib == bb.rend() && na == nb;
+
+			return (ia - ba.rbegin()) == (ib - bb.rbegin());
+		}
+		else if(s.kind(a) == EXPR_APPLY)
+		{
+			return alpha_equivalent(s, s.fn(a), s.fn(b), ba, bb)
+				&& alpha_equivalent(s, s.arg(a), s.arg(b), ba, bb);
+		}
+		else
+		{
+			ba.push_back(&s.binder(a));
+			bb.push_back(&s.binder(b));
+
+			bool ret = alpha_equivalent(s, s.body(a), s.body(b), ba, bb);
+
+			ba.pop_back();
+			bb.pop_back();
+
+			return ret;
+		}
+	}
+
+	template <typename S>
+	bool alpha_equivalent(const S& s, typename S::Ref a, typename S::Ref b)
+	{
+		std::vector<const std::string*> ba;
+		std::vector<const std::string*> bb;
+		return alpha_equivalent(s, a, b, ba, bb);
+	}
+
+	// capture-avoiding body[name := value]; `value_free` are the free variables of `value`.
+	// unchanged subterms are shared rather than rebuilt.
+	template <typename S>
+	typename S::Ref substitute(S& s, typename S::Ref body, const std::string& name, typename S::Ref value,
+		const std::set<std::string>& value_free)
+	{
+		if(s.kind(body) == EXPR_VAR)
+		{
+			return s.name(body) == name ? value : body;
+		}
+		else if(s.kind(body) == EXPR_APPLY)
+		{
+			auto f = substitute(s, s.fn(body), name, value, value_free);
+			auto a = substitute(s, s.arg(body), name, value, value_free);
+
+			if(f == s.fn(body) && a == s.arg(body))
+				return body;
+
+			return s.apply(f, a);
+		}
+		else
+		{
+			// note: store operations can invalidate the references, so copy the name.
+			auto binder = std::string(s.binder(body));
+			auto inner = s.body(body);
+
+			if(binder == name || !is_free_in(s, inner, name))
+				return body;
+
+			if(value_free.find(binder) != value_free.end())
+			{
+				auto fresh = binder + "'";
+				while(value_free.find(fresh) != value_free.end() || is_free_in(s, inner, fresh))
+					fresh += "'";
+
+				inner = substitute(s, inner, binder, s.var(fresh), { fresh });
+				binder = fresh;
+			}
+
+			return s.lambda(binder, substitute(s, inner, name, value, value_free));
+		}
+	}
+
+	// one leftmost-outermost β-reduction; returns false if `r` is already in normal form.
+	template <typename S>
+	bool step(S& s, typename S::Ref& r)
+	{
+		if(s.kind(r) == EXPR_LAMBDA)
+		{
+			auto body = s.body(r);
+			if(!step(s, body))
+				return false;
+
+			r = s.lambda(std::string(s.binder(r)), body);
+			return true;
+		}
+		else if(s.kind(r) == EXPR_APPLY)
+		{
+			auto f = s.fn(r);
+			auto a = s.arg(r);
+
+			if(s.kind(f) == EXPR_LAMBDA)
+			{
+				r = substitute(s, s.body(f), std::string(s.binder(f)), a, free_variables(s, a));
+				return true;
+			}
+
+			if(step(s, f))
+				return (r = s.apply(f, a)), true;
+
+			if(step(s, a))
+				return (r = s.apply(s.fn(r), a)), true;
+		}
+
+		return false;
+	}
+
+	// whether step() would do nothing, without making any nodes.
+	template <typename S>
+	bool is_normal(const S& s, typename S::Ref r)
+	{
+		switch(s.kind(r))
+		{
+			case EXPR_APPLY:    return s.kind(s.fn(r)) != EXPR_LAMBDA && is_normal(s, s.fn(r)) && is_normal(s, s.arg(r));
+			case EXPR_LAMBDA:   return is_normal(s, s.body(r));
+			default:            return true;
+		}
+	}
+
+	// returns false if `r` wasn't normal after `max_steps` steps; `steps` counts the steps taken.
+	template <typename S>
+	bool normalise(S& s, typename S::Ref& r, int max_steps, int& steps)
+	{
+		steps = 0;
+		while(steps < max_steps)
+		{
+			if(!step(s, r))
+				return true;
+
+			steps++;
+		}
+
+		// the last step might have been the one that made it normal.
+		return is_normal(s, r);
+	}
+
+
+
+
+	// copies a term from one store to another; if `seen` is given, shared subterms stay shared.
+	template <typename To, typename From>
+	typename To::Ref transfer(To& to, const From& from, typename From::Ref r,
+		std::unordered_map<typename From::Ref, typename To::Ref>* seen = nullptr)
+	{
+		if(seen != nullptr)
+		{
+			if(auto it = seen->find(r); it != seen->end())
+				return it->second;
+		}
+
+		typename To::Ref ret;
+		if(from.kind(r) == EXPR_VAR)
+		{
+			ret = to.var(from.name(r));
+		}
+		else if(from.kind(r) == EXPR_APPLY)
+		{
+			auto f = transfer(to, from, from.fn(r), seen);
+			ret = to.apply(f, transfer(to, from, from.arg(r), seen));
+		}
+		else
+		{
+			ret = to.lambda(from.binder(r), transfer(to, from, from.body(r), seen));
+		}
+
+		if(seen != nullptr)
+			(*seen)[r] = ret;
+
+		return ret;
+	}
+
+	template <typename S>
+	typename S::Ref import_expr(S& s, const ast::Expr* expr)
+	{
+		return transfer(s, Ast(), expr);
+	}
+
+	// the result is an ordinary ast::Expr, owned by the caller.
+	template <typename S>
+	ast::Expr* export_expr(const S& s, typename S::Ref r)
+	{
+		auto builder = Ast();
+		return const_cast<ast::Expr*>(transfer(builder, s, r));
+	}
+
+	// stores never free anything, so once they get big, move the live term into a new one.
+	template <typename S>
+	void compact(S& s, typename S::Ref& r)
+	{
+		S fresh;
+		std::unordered_map<typename S::Ref, typename S::Ref> seen;
+
+		r = transfer(fresh, s, r, &seen);
+		s = std::move(fresh);
+	}
+}
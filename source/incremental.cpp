@@ -0,0 +1,198 @@
+// incremental.cpp
+// Copyright (c) 2021, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "ast.h"
+#include "defs.h"
+
+namespace lc
+{
+	using namespace ast;
+
+	// util.cpp
+	size_t hash_expr(const Expr* expr);
+	size_t hash_subterms(const Expr* expr, std::unordered_map<const Expr*, std::pair<size_t, size_t>>& subterms);
+	bool identical(const Expr* a, const Expr* b);
+
+	// how many normal forms we keep around, and how hard we try to normalise a subterm
+	// that was carried over from the previous input before giving up on it.
+	constexpr size_t MAX_NORMAL_FORMS   = 1024;
+	constexpr int MAX_PRECOMPUTE_STEPS  = 100000;
+
+	using Subterms = std::unordered_map<const Expr*, std::pair<size_t, size_t>>;
+
+	namespace {
+		// the evaluator reduces a term completely if it's only underneath lambdas; anywhere else, it
+		// stops once the term isn't an application that can be reduced anymore (see eval.cpp). so
+		// where a subterm is decides what it would have become in place.
+		enum class Place { Top, Function, Argument };
+	}
+
+	// the same term in different places reduces differently, and multi-argument reduction picks
+	// different names. (multi_beta_reduction() can also reach into a function from the outside, so
+	// with FLAG_MULTI_BETA, functions aren't reused at all.)
+	static size_t key(size_t hash, Place place, int flags)
+	{
+		return (hash * 3 + static_cast<size_t>(place)) * 2 + ((flags & FLAG_MULTI_BETA) ? 1 : 0);
+	}
+
+	// results are kept for terms that are exactly the same, names and all; since renaming is
+	// deterministic, reducing the same term always gives the same result. an alpha-equivalent
+	// term would give one with different names.
+	static const Context::NormalForm* find_normal_form(Context& ctx, const Expr* term, size_t key)
+	{
+		if(auto it = ctx.normal_forms.find(key); it != ctx.normal_forms.end())
+		{
+			if(identical(it->second.term, term))
+				return &it->second;
+		}
+
+		return nullptr;
+	}
+
+	// the same thing that the evaluator would have done to `expr`, in that place.
+	static bool reduce_in(Place place, Expr** expr, int flags, int& steps)
+	{
+		if(place == Place::Top)
+			return reduce(expr, flags, MAX_PRECOMPUTE_STEPS, steps);
+
+		return reduce_application(expr, flags, place == Place::Argument, MAX_PRECOMPUTE_STEPS, steps);
+	}
+
+	// takes ownership of both `term` and `normal`.
+	static void insert_normal_form(Context& ctx, size_t hash, Expr* term, Expr* normal)
+	{
+		if(auto it = ctx.normal_forms.find(hash); it != ctx.normal_forms.end())
+		{
+			// a hash collision; the newer one wins.
+			delete it->second.term;
+			delete it->second.normal;
+			it->second = { term, normal };
+			return;
+		}
+
+		while(ctx.normal_form_order.size() >= MAX_NORMAL_FORMS)
+		{
+			auto it = ctx.normal_forms.find(ctx.normal_form_order.front());
+			delete it->second.term;
+			delete it->second.normal;
+
+			ctx.normal_forms.erase(it);
+			ctx.normal_form_order.pop_front();
+		}
+
+		ctx.normal_forms[hash] = { term, normal };
+		ctx.normal_form_order.push_back(hash);
+	}
+
+	// replaces the largest closed subterms that we already know the result of, in the places where
+	// the evaluator would reduce them. closed subterms that also appeared in the previous input (ie.
+	// the parts that weren't edited) are reduced on their own first, so the next edit can reuse them.
+	//
+	// that's the top and the bodies of lambdas there, the function of an application there, and the
+	// argument of one whose function is a variable. the evaluator never reduces a lambda in argument
+	// position, the other arguments of a stuck application, or an argument before it's substituted,
+	// so reusing anything in those places could change the result.
+	static void reuse(Context& ctx, Expr** slot, Place place, int flags, const Subterms& subterms, size_t& reused)
+	{
+		auto expr = *slot;
+		auto [ hash, need ] = subterms.at(expr);
+
+		if(need == 0)
+		{
+			if(auto nf = find_normal_form(ctx, expr, key(hash, place, flags)); nf != nullptr)
+			{
+				// if it didn't finish last time, it won't this time either.
+				if(nf->normal == nullptr)
+					return;
+
+				*slot = nf->normal->clone();
+				delete expr;
+
+				reused++;
+				return;
+			}
+			else if(ctx.last_subterms.find(hash) != ctx.last_subterms.end())
+			{
+				int steps = 0;
+				auto normal = expr->clone();
+				if(!reduce_in(place, &normal, flags, steps))
+				{
+					delete normal;
+					insert_normal_form(ctx, key(hash, place, flags), expr->clone(), nullptr);
+					return;
+				}
+
+				// don't bother remembering things that were already done.
+				if(steps > 0)
+				{
+					*slot = normal->clone();
+					insert_normal_form(ctx, key(hash, place, flags), expr, normal);
+
+					reused++;
+				}
+				else
+				{
+					delete normal;
+				}
+
+				return;
+			}
+		}
+
+		if(auto l = dynamic_cast<Lambda*>(expr); l != nullptr)
+		{
+			if(place == Place::Top)
+				reuse(ctx, &l->body, Place::Top, flags, subterms, reused);
+		}
+		else if(auto a = dynamic_cast<Apply*>(expr); a != nullptr)
+		{
+			if(dynamic_cast<Apply*>(a->fn) != nullptr && !(flags & FLAG_MULTI_BETA))
+				reuse(ctx, &a->fn, Place::Function, flags, subterms, reused);
+
+			else if(dynamic_cast<Var*>(a->fn) != nullptr)
+				reuse(ctx, &a->arg, Place::Argument, flags, subterms, reused);
+		}
+	}
+
+	void reuse_normal_forms(Context& ctx, Expr** expr, int print_flags)
+	{
+		// nothing else changes what a term reduces to.
+		auto flags = print_flags & FLAG_MULTI_BETA;
+
+		Subterms subterms;
+		hash_subterms(*expr, subterms);
+
+		std::set<size_t> closed;
+		for(auto& [ _, info ] : subterms)
+		{
+			if(info.second == 0)
+				closed.insert(info.first);
+		}
+
+		size_t reused = 0;
+		reuse(ctx, expr, Place::Top, flags, subterms, reused);
+
+		ctx.last_subterms = std::move(closed);
+
+		if(reused > 0 && (print_flags & FLAG_TRACE))
+		{
+			zpr::println("{}*.{} reused {} earlier result{}", BLACK_BOLD, COLOUR_RESET, reused,
+				reused == 1 ? "" : "s");
+		}
+	}
+
+	// takes ownership of both `term` and `normal`.
+	void remember_normal_form(Context& ctx, Expr* term, Expr* normal, int print_flags)
+	{
+		auto k = key(hash_expr(term), Place::Top, print_flags & FLAG_MULTI_BETA);
+		if(find_normal_form(ctx, term, k) != nullptr)
+		{
+			delete term;
+			delete normal;
+			return;
+		}
+
+		insert_normal_form(ctx, k, term, normal);
+	}
+}
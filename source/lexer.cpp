@@ -56,8 +56,20 @@ namespace parser
 		return Ok<Token>(tok, Location { idx, x }, take_and_return_taken(src, x));  \
 	}
 
-		if      MATCH_MULTICHAR_TOKEN("->", TT::RightArrow)
+		if      MATCH_MULTICHAR_TOKEN("==>", TT::LongArrow)
+		else if MATCH_MULTICHAR_TOKEN("->", TT::RightArrow)
 		else if MATCH_MULTICHAR_TOKEN("λ", TT::Lambda)
+		else if(src[0] == '$' && src.size() > 1 && '0' <= src[1] && src[1] <= '9')
+		{
+			// result registers ($1, $2, ...) are identifiers; '$ 1' is still an application.
+			size_t n = 1;
+			while(n < src.size() && '0' <= src[n] && src[n] <= '9')
+				n++;
+
+			auto ret = Token(TT::Identifier, Location { idx, n }, src.take(n));
+			src.remove_prefix(n);
+			return Ok(ret);
+		}
 		else if(is_valid_identifier(src) > 0)
 		{
 			size_t identLength = is_valid_identifier(src);
@@ -14,13 +14,49 @@ int main(int argc, char** argv)
 {
 	lc::Context ctx {};
 
-	// TODO: support flags or something
+	bool batch = false;
+	bool check = false;
+	int max_steps = lc::DEFAULT_CHECK_STEPS;
+	int timeout_ms = lc::DEFAULT_CHECK_TIMEOUT_MS;
+
+	std::vector<zbuf::str_view> files;
+
 	for(int i = 1; i < argc; i++)
 	{
 		auto f = argv[i];
-		lc::loadFile(ctx, zbuf::str_view(f, strlen(f)));
+		if(strcmp(f, "--batch") == 0)
+			batch = true;
+
+		else if(strcmp(f, "--check") == 0)
+			check = true;
+
+		else if(strcmp(f, "--profile") == 0)
+			ctx.flags |= lc::FLAG_PROFILE;
+
+		else if(strcmp(f, "--max-steps") == 0 && i + 1 < argc)
+			max_steps = atoi(argv[++i]);
+
+		else if(strcmp(f, "--timeout") == 0 && i + 1 < argc)
+			timeout_ms = (int) (atof(argv[++i]) * 1000);
+
+		else
+			files.push_back(zbuf::str_view(f, strlen(f)));
+	}
+
+	// --batch evaluates (and prints) every expression in the files, then quits.
+	if(batch)
+	{
+		lc::runBatch(ctx, files);
+		return 0;
 	}
 
+	// --check runs every `expr ==> expected` in the files, then quits.
+	if(check)
+		return lc::runChecks(ctx, files, max_steps, timeout_ms);
+
+	for(auto f : files)
+		lc::loadFile(ctx, f);
+
 	lc::repl(ctx);
 
 #if 0
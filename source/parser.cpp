@@ -228,7 +228,15 @@ namespace parser
 		}
 		else
 		{
-			return parseExpr(st);
+			auto expr = parseExpr(st);
+			if(!expr || st.peek() != TT::LongArrow)
+				return expr;
+
+			auto arrow = st.pop();
+			auto expected = parseExpr(st);
+			if(!expected) return expected;
+
+			return makeAST<ast::Assert>(arrow.loc, *expr, *expected);
 		}
 	}
 
@@ -328,7 +336,7 @@ namespace parser
 		while(true)
 		{
 			// if it's time, then stop.
-			if(st.peek() == TT::RParen || st.peek() == TT::EndOfFile)
+			if(st.peek() == TT::RParen || st.peek() == TT::LongArrow || st.peek() == TT::EndOfFile)
 				return lhs;
 
 			ResultTy rhs = Err(Error { });
@@ -0,0 +1,226 @@
+// profile.cpp
+// Copyright (c) 2021, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "ast.h"
+#include "defs.h"
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <signal.h>
+#include <sys/time.h>
+
+namespace lc
+{
+	// a SIGPROF every PROFILE_INTERVAL_US of cpu time records the definitions that the evaluator is
+	// currently inside of. nodes know which definition they came from (Expr::origin, set when a
+	// name is expanded), and eval.cpp keeps a stack of those on the way down to each redex.
+	constexpr long PROFILE_INTERVAL_US  = 1000;
+	constexpr int MAX_PROFILE_DEPTH     = 16;
+	constexpr size_t MAX_PROFILE_SAMPLES = 65536;
+
+	namespace {
+		struct Sample
+		{
+			int depth;
+			const std::string* frames[MAX_PROFILE_DEPTH];
+		};
+
+		// per thread, so the evaluators in --batch can be sampled at the same time.
+		struct Stack
+		{
+			int active = 0;
+			int depth = 0;
+			const std::string* frames[MAX_PROFILE_DEPTH];
+		};
+
+		struct Node
+		{
+			size_t total = 0;
+			size_t self = 0;
+			std::map<const std::string*, Node> children;
+		};
+	}
+
+	static thread_local Stack stack;
+
+	// the handler can't allocate, so samples go into a fixed buffer.
+	static Sample samples[MAX_PROFILE_SAMPLES];
+	static std::atomic<size_t> num_samples = 0;
+
+	// reportProfile() sets `paused`, then waits for handlers that are already running to finish,
+	// so nothing writes to `samples` while it is being read. both are lock-free, so they're safe to
+	// use in the handler.
+	static std::atomic<bool> paused = false;
+	static std::atomic<int> in_handler = 0;
+
+	static std::mutex timer_lock;
+	static int timers = 0;
+
+	static void on_sample(int)
+	{
+		if(stack.active == 0)
+			return;
+
+		in_handler++;
+		if(!paused)
+		{
+			auto n = num_samples.fetch_add(1);
+			if(n < MAX_PROFILE_SAMPLES)
+			{
+				auto& s = samples[n];
+				s.depth = std::min(stack.depth, MAX_PROFILE_DEPTH);
+				for(int i = 0; i < s.depth; i++)
+					s.frames[i] = stack.frames[i];
+			}
+		}
+		in_handler--;
+	}
+
+	static void set_timer(long us)
+	{
+		itimerval tv { };
+		tv.it_value.tv_sec = us / 1000000;
+		tv.it_value.tv_usec = us % 1000000;
+		tv.it_interval = tv.it_value;
+
+		setitimer(ITIMER_PROF, &tv, nullptr);
+	}
+
+	void startProfiling()
+	{
+		// nested reductions (eg. from ':memo') are part of the outer one.
+		if(stack.active++ > 0)
+			return;
+
+		std::lock_guard<std::mutex> lk(timer_lock);
+		if(timers++ > 0)
+			return;
+
+		struct sigaction sa { };
+		sa.sa_handler = on_sample;
+		sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGPROF, &sa, nullptr);
+
+		set_timer(PROFILE_INTERVAL_US);
+	}
+
+	void stopProfiling()
+	{
+		if(--stack.active > 0)
+			return;
+
+		std::lock_guard<std::mutex> lk(timer_lock);
+		if(--timers == 0)
+			set_timer(0);
+	}
+
+	// returns false (and doesn't push) if we're already inside `origin`.
+	bool pushOrigin(const std::string* origin)
+	{
+		if(stack.depth > 0 && stack.depth <= MAX_PROFILE_DEPTH && stack.frames[stack.depth - 1] == origin)
+			return false;
+
+		// frames past the limit are counted, but not recorded.
+		if(stack.depth < MAX_PROFILE_DEPTH)
+			stack.frames[stack.depth] = origin;
+
+		stack.depth++;
+		return true;
+	}
+
+	void popOrigin()
+	{
+		stack.depth--;
+	}
+
+	static std::string frame_name(const std::string* frame)
+	{
+		return frame == nullptr ? "<input>" : *frame;
+	}
+
+	static std::string percent(size_t n, size_t total)
+	{
+		auto s = zpr::sprint("{.1f}%", 100.0 * n / total);
+		return std::string(s.size() < 6 ? 6 - s.size() : 0, ' ') + s;
+	}
+
+	static void print_tree(const Node& node, const std::string* frame, size_t total, int indent)
+	{
+		zpr::println("  {}  {}  {}{}", percent(node.total, total), percent(node.self, total),
+			std::string(2 * indent, ' '), frame_name(frame));
+
+		std::vector<std::pair<const std::string*, const Node*>> children;
+		for(auto& [ f, n ] : node.children)
+			children.emplace_back(f, &n);
+
+		std::sort(children.begin(), children.end(), [](auto& a, auto& b) { return a.second->total > b.second->total; });
+		for(auto& [ f, n ] : children)
+			print_tree(*n, f, total, indent + 1);
+	}
+
+	// prints (and forgets) everything sampled since the last report.
+	void reportProfile()
+	{
+		paused = true;
+		while(in_handler > 0)
+			std::this_thread::yield();
+
+		auto total = std::min(num_samples.exchange(0), MAX_PROFILE_SAMPLES);
+		if(total == 0)
+		{
+			paused = false;
+			return;
+		}
+
+		// self: samples where the definition was innermost. total: samples where it was anywhere
+		// on the stack, counted once even if it appears more than once (eg. in recursion).
+		std::map<const std::string*, std::pair<size_t, size_t>> flat;
+
+		Node root;
+		for(size_t i = 0; i < total; i++)
+		{
+			auto& s = samples[i];
+
+			std::set<const std::string*> seen;
+			auto node = &root;
+			node->total++;
+
+			for(int k = 0; k < s.depth; k++)
+			{
+				if(seen.insert(s.frames[k]).second)
+					flat[s.frames[k]].second++;
+
+				node = &node->children[s.frames[k]];
+				node->total++;
+			}
+
+			node->self++;
+			flat[s.depth == 0 ? nullptr : s.frames[s.depth - 1]].first++;
+		}
+
+		paused = false;
+
+		if(flat.find(nullptr) != flat.end())
+			flat[nullptr].second = total;
+
+		std::vector<std::pair<const std::string*, std::pair<size_t, size_t>>> rows(flat.begin(), flat.end());
+		std::sort(rows.begin(), rows.end(), [](auto& a, auto& b) { return a.second.first > b.second.first; });
+
+		zpr::println("{}*.{} profile: {} sample{} ({.1f} ms of cpu)", BLACK_BOLD, COLOUR_RESET, total,
+			total == 1 ? "" : "s", total * PROFILE_INTERVAL_US / 1000.0);
+
+		zpr::println("  {}  self   total  definition{}", GREY_BOLD, COLOUR_RESET);
+		for(auto& [ frame, counts ] : rows)
+		{
+			zpr::println("  {}  {}  {}", percent(counts.first, total), percent(counts.second, total),
+				frame_name(frame));
+		}
+
+		zpr::println("\n  {} total    self  call tree{}", GREY_BOLD, COLOUR_RESET);
+		print_tree(root, nullptr, total, 0);
+		zpr::println("");
+	}
+}
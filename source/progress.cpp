@@ -0,0 +1,143 @@
+// progress.cpp
+// Copyright (c) 2021, zhiayang
+// Licensed under the Apache License Version 2.0.
+
+#include "ast.h"
+#include "defs.h"
+
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+namespace lc
+{
+	using namespace ast;
+
+	// the evaluator only looks at a flag on every step; the actual work of measuring
+	// the term and printing happens when a timer sets it.
+	constexpr long PROGRESS_INTERVAL_MS = 250;
+
+	static volatile sig_atomic_t tick = 0;
+
+	static int depth = 0;
+	static FILE* csv_file = nullptr;
+
+	static double start_time = 0;
+	static double last_time = 0;
+	static int last_steps = 0;
+
+	static double now()
+	{
+		timespec ts { };
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec + ts.tv_nsec / 1e9;
+	}
+
+	static size_t term_size(const Expr* expr)
+	{
+		if(auto a = dynamic_cast<const Apply*>(expr); a != nullptr)
+			return 1 + term_size(a->fn) + term_size(a->arg);
+
+		else if(auto l = dynamic_cast<const Lambda*>(expr); l != nullptr)
+			return 1 + term_size(l->body);
+
+		else
+			return 1;
+	}
+
+	static long peak_rss_kb()
+	{
+		rusage ru { };
+		getrusage(RUSAGE_SELF, &ru);
+		return ru.ru_maxrss;
+	}
+
+	static void set_timer(long ms)
+	{
+		itimerval tv { };
+		tv.it_value.tv_sec = ms / 1000;
+		tv.it_value.tv_usec = (ms % 1000) * 1000;
+		tv.it_interval = tv.it_value;
+
+		setitimer(ITIMER_REAL, &tv, nullptr);
+	}
+
+	// returns false (after printing why) if the file couldn't be opened; the old log is closed either way.
+	bool setProgressLog(zbuf::str_view path)
+	{
+		if(csv_file != nullptr)
+			fclose(csv_file), csv_file = nullptr;
+
+		if(path.empty())
+			return true;
+
+		csv_file = fopen(path.str().c_str(), "w");
+		if(csv_file == nullptr)
+		{
+			printError(zpr::sprint("failed to open file '{}': {}", path, strerror(errno)));
+			return false;
+		}
+
+		zpr::fprintln(csv_file, "seconds,steps,steps_per_second,term_size,peak_rss_kb");
+		return true;
+	}
+
+	void startProgress()
+	{
+		// nested reductions (eg. from ':memo') just count towards the outer one.
+		if(depth++ > 0)
+			return;
+
+		struct sigaction sa { };
+		sa.sa_handler = [](int) { tick = 1; };
+		sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGALRM, &sa, nullptr);
+
+		tick = 0;
+		last_steps = 0;
+		start_time = last_time = now();
+
+		set_timer(PROGRESS_INTERVAL_MS);
+	}
+
+	void stopProgress()
+	{
+		if(--depth > 0)
+			return;
+
+		set_timer(0);
+
+		// clear the meter line.
+		zpr::fprint(stderr, "\r\x1b[K");
+		if(csv_file != nullptr)
+			fflush(csv_file);
+	}
+
+	bool progressDue()
+	{
+		return tick != 0;
+	}
+
+	void reportProgress(int steps, const Expr* expr)
+	{
+		tick = 0;
+
+		auto t = now();
+		auto rate = (steps - last_steps) / std::max(t - last_time, 1e-6);
+		auto size = term_size(expr);
+		auto rss = peak_rss_kb();
+
+		last_time = t;
+		last_steps = steps;
+
+		zpr::fprint(stderr, "\r{}*.{} {} steps ({.0f}/s), size {}, peak rss {.1f} MiB\x1b[K", BLACK_BOLD,
+			COLOUR_RESET, steps, rate, size, rss / 1024.0);
+
+		if(csv_file != nullptr)
+			zpr::fprintln(csv_file, "{.3f},{},{.0f},{},{}", t - start_time, steps, rate, size, rss);
+	}
+}
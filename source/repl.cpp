@@ -13,10 +13,18 @@ namespace lc
 	void runReplCommand(Context& ctx, zbuf::str_view cmd);
 	void parseError(parser::Error e, zbuf::str_view input);
 
+	// progress.cpp
+	bool setProgressLog(zbuf::str_view path);
+
+	// bench.cpp
+	void runBench(Context& ctx, zbuf::str_view input);
+
 	// util.cpp
+	bool memoise(Context& ctx, const std::string& name);
 	bool alpha_equivalent(Context& ctx, const ast::Expr* a, const ast::Expr* b);
 
-	static void print_replacing_vars(Context& ctx, const ast::Expr* e);
+	void print_replacing_vars(Context& ctx, const ast::Expr* e);
+	static void run_map_command(Context& ctx, zbuf::str_view input);
 
 	void evalLine(Context& ctx, zbuf::str_view sv)
 	{
@@ -39,8 +47,30 @@ namespace lc
  		if(!expr_or_error)
  			return parseError(expr_or_error.error(), input);
 
-		auto expr = lc::evaluate(ctx, expr_or_error.unwrap(), ctx.flags);
+		auto parsed = expr_or_error.unwrap();
+		if(parsed->type == ast::EXPR_ASSERT)
+		{
+			lc::checkAssertion(ctx, parsed, ctx.flags);
+			delete parsed;
+
+			if(ctx.flags & FLAG_PROFILE)
+				lc::reportProfile();
+
+			return;
+		}
+
+		auto expr = lc::evaluate(ctx, parsed, ctx.flags);
+
+		if(parsed->type != ast::EXPR_LET)
+		{
+			ctx.results.push_back(expr);
+			zpr::print("{}${}:{} ", BLACK_BOLD, ctx.results.size(), COLOUR_RESET);
+		}
+
 		print_replacing_vars(ctx, expr);
+
+		if(ctx.flags & FLAG_PROFILE)
+			lc::reportProfile();
 	}
 
 	void repl(Context& ctx)
@@ -66,7 +96,7 @@ namespace lc
 		zpr::println("");
 	}
 
-	static void print_replacing_vars(Context& ctx, const ast::Expr* e)
+	void print_replacing_vars(Context& ctx, const ast::Expr* e)
 	{
 		auto normal = lc::print(e, ctx.flags);
 
@@ -96,6 +126,57 @@ namespace lc
 
 
 
+	// :map f, a, b, c -- evaluates (f a), (f b), (f c), one after the other.
+	static void run_map_command(Context& ctx, zbuf::str_view input)
+	{
+		std::vector<zbuf::str_view> parts;
+		while(true)
+		{
+			auto k = input.find(',');
+			parts.push_back(trim(input.take(k)));
+
+			if(k == (size_t) -1)
+				break;
+
+			input.remove_prefix(k + 1);
+		}
+
+		if(parts.size() < 2)
+			return printError("expected ':map <function>, <input>, ...'");
+
+		std::vector<const ast::Expr*> exprs;
+		auto cleanup = [&exprs]() {
+			for(auto e : exprs)
+				delete e;
+		};
+
+		for(auto part : parts)
+		{
+			auto expr_or_error = parser::parse(part);
+			if(!expr_or_error)
+				return cleanup(), parseError(expr_or_error.error(), part);
+
+			exprs.push_back(expr_or_error.unwrap());
+			if(exprs.back()->type == ast::EXPR_LET)
+				return cleanup(), printError("'let' is not allowed in ':map'");
+
+			else if(exprs.back()->type == ast::EXPR_ASSERT)
+				return cleanup(), printError("'==>' is not allowed in ':map'");
+		}
+
+		auto inputs = std::vector<const ast::Expr*>(exprs.begin() + 1, exprs.end());
+		auto results = lc::evaluateBatch(ctx, exprs[0], inputs, ctx.flags);
+
+		for(size_t i = 0; i < results.size(); i++)
+		{
+			zpr::println("{}{}.{} {}", BLACK_BOLD, i, COLOUR_RESET, parts[i + 1]);
+			print_replacing_vars(ctx, results[i]);
+			delete results[i];
+		}
+
+		cleanup();
+	}
+
 	void runReplCommand(Context& ctx, zbuf::str_view input)
 	{
 		auto print_thingy = [&ctx](const char* thing, int f) {
@@ -129,11 +210,69 @@ namespace lc
 			ctx.flags ^= FLAG_VAR_REPLACEMENT;
 			print_thingy("reverse variable substitution", FLAG_VAR_REPLACEMENT);
 		}
+		else if(input == ":i")
+		{
+			ctx.flags ^= FLAG_INCREMENTAL;
+			print_thingy("incremental evaluation", FLAG_INCREMENTAL);
+		}
+		else if(input == ":prof")
+		{
+			ctx.flags ^= FLAG_PROFILE;
+			print_thingy("profiling", FLAG_PROFILE);
+		}
+		else if(input == ":lazy")
+		{
+			ctx.flags ^= FLAG_LAZY_RENAME;
+			print_thingy("suspended renaming", FLAG_LAZY_RENAME);
+		}
+		else if(input == ":nary")
+		{
+			ctx.flags ^= FLAG_MULTI_BETA;
+			print_thingy("multi-argument β-reduction", FLAG_MULTI_BETA);
+		}
+		else if(input == ":fuse")
+		{
+			ctx.flags ^= FLAG_FUSION;
+			print_thingy("list fusion", FLAG_FUSION);
+		}
+		else if(input == ":progress")
+		{
+			ctx.flags ^= FLAG_PROGRESS;
+			print_thingy("progress meter", FLAG_PROGRESS);
+		}
+		else if(input == ":csv" || input.find(":csv ") == 0)
+		{
+			auto path = trim(input.drop(strlen(":csv")));
+			if(!lc::setProgressLog(path))
+				return;
+
+			if(path.empty())
+				zpr::println("{}*.{} progress log closed", BLACK_BOLD, COLOUR_RESET);
+			else
+				zpr::println("{}*.{} logging progress to '{}'", BLACK_BOLD, COLOUR_RESET, path);
+		}
 		else if(input == ":ft")
 		{
 			ctx.flags ^= FLAG_FULL_TRACE;
 			print_thingy("full tracing", FLAG_FULL_TRACE);
 		}
+		else if(input.find(":map ") == 0)
+		{
+			run_map_command(ctx, trim(input.drop(strlen(":map "))));
+		}
+		else if(input.find(":bench ") == 0)
+		{
+			lc::runBench(ctx, trim(input.drop(strlen(":bench "))));
+		}
+		else if(input.find(":memo ") == 0)
+		{
+			auto name = trim(input.drop(strlen(":memo "))).str();
+			if(lc::memoise(ctx, name))
+			{
+				zpr::println("{}*.{} memoising calls to {}{}{}", BLACK_BOLD, COLOUR_RESET,
+					BLACK_BOLD, name, COLOUR_RESET);
+			}
+		}
 		else if(input.find(":load ") == 0)
 		{
 			auto path = trim(input.drop(strlen(":load ")));
@@ -170,10 +309,10 @@ namespace lc
 
 	zbuf::str_view trim(zbuf::str_view s)
 	{
-		while(s.front() == ' ' || s.front() == '\t')
+		while(!s.empty() && (s.front() == ' ' || s.front() == '\t'))
 			s.remove_prefix(1);
 
-		while(s.back() == ' ' || s.back() == '\t')
+		while(!s.empty() && (s.back() == ' ' || s.back() == '\t'))
 			s.remove_suffix(1);
 
 		return s;
@@ -4,10 +4,12 @@
 
 #include "ast.h"
 #include "defs.h"
+#include "store.h"
 
 #include <set>
 #include <map>
 #include <climits>
+#include <charconv>
 #include <iterator>
 #include <algorithm>
 
@@ -18,8 +20,30 @@ namespace lc
 	// eval.cpp
 	Expr* alpha_conversion(Expr* e, std::string name, const std::string& fresh);
 
+	// fuse.cpp
+	Expr* fuse_lists(const Context& ctx, const Expr* expr);
+
 	// below
 	std::set<const Var*> find_free_variables(const Expr* expr);
+	std::set<std::string> find_free_names(const Expr* expr);
+	std::string fresh_name(const std::string& name);
+
+	// nodes that already came from somewhere else (ie. a nested definition) keep their origin.
+	static void set_origin(Expr* expr, const std::string* origin)
+	{
+		if(expr->origin == nullptr)
+			expr->origin = origin;
+
+		if(auto a = dynamic_cast<Apply*>(expr); a != nullptr)
+		{
+			set_origin(a->fn, origin);
+			set_origin(a->arg, origin);
+		}
+		else if(auto l = dynamic_cast<Lambda*>(expr); l != nullptr)
+		{
+			set_origin(l->body, origin);
+		}
+	}
 
 	// bool is true if we replaced something.
 	static std::pair<Expr*, bool> replace_vars_once(const Context& ctx, const std::set<const Var*>& free_vars, const Expr* expr)
@@ -29,7 +53,13 @@ namespace lc
 			if(free_vars.find(v) != free_vars.end())
 			{
 				if(auto it = ctx.vars.find(v->name); it != ctx.vars.end())
-					return { it->second->clone(), true };
+				{
+					// the keys of ctx.vars are never removed, so they can be pointed to.
+					auto ret = it->second->clone();
+					set_origin(ret, &it->first);
+
+					return { ret, true };
+				}
 			}
 
 			return { v->clone(), false };
@@ -38,12 +68,20 @@ namespace lc
 		{
 			auto x = replace_vars_once(ctx, free_vars, a->fn);
 			auto y = replace_vars_once(ctx, free_vars, a->arg);
-			return { new Apply(a->loc, x.first, y.first), x.second || y.second };
+
+			auto ret = new Apply(a->loc, x.first, y.first);
+			ret->origin = a->origin;
+
+			return { ret, x.second || y.second };
 		}
 		else if(auto l = dynamic_cast<const Lambda*>(expr); l != nullptr)
 		{
 			auto body = replace_vars_once(ctx, free_vars, l->body);
-			return { new Lambda(l->loc, l->argloc, l->arg, body.first), body.second };
+			auto ret = new Lambda(l->loc, l->argloc, l->arg, body.first);
+			ret->memo = l->memo;
+			ret->origin = l->origin;
+
+			return { ret, body.second };
 		}
 		else
 		{
@@ -56,9 +94,25 @@ namespace lc
 		const Expr* ret = expr;
 		while(true)
 		{
+			// list pipelines can only be recognised while their names are still there, and each
+			// round of expansion might uncover more of them.
+			if(ctx.flags & FLAG_FUSION)
+			{
+				if(auto fused = fuse_lists(ctx, ret); fused != nullptr)
+				{
+					if(ret != expr)
+						delete ret;
+
+					ret = fused;
+				}
+			}
+
 			auto [ next, changed ] = replace_vars_once(ctx, find_free_variables(ret), ret);
 			if(!changed)
 			{
+				if(ret != expr)
+					delete ret;
+
 				return next;
 			}
 			else
@@ -71,36 +125,415 @@ namespace lc
 		}
 	}
 
-	std::vector<Expr**> find_substitutions(Expr** expr, const std::string& var)
+	static const Expr* find_register(const Context& ctx, const std::string& name)
+	{
+		if(name == "it")
+			return ctx.results.empty() ? nullptr : ctx.results.back();
+
+		if(name.size() < 2 || name[0] != '$')
+			return nullptr;
+
+		// the lexer only makes these out of digits, but there can be too many of them.
+		size_t n = 0;
+		auto [ end, err ] = std::from_chars(name.data() + 1, name.data() + name.size(), n);
+		if(err != std::errc() || end != name.data() + name.size() || n == 0 || n > ctx.results.size())
+		{
+			printError(zpr::sprint("no such register '{}'", name));
+			return nullptr;
+		}
+
+		return ctx.results[n - 1];
+	}
+
+	static void splice_registers(const Context& ctx, Expr** expr, std::vector<const std::string*>& bound)
 	{
 		if(auto v = dynamic_cast<Var*>(*expr); v != nullptr)
 		{
-			if(v->name == var)  return { expr };
-			else                return { };
+			if(std::find_if(bound.begin(), bound.end(), [v](auto b) { return *b == v->name; }) != bound.end())
+				return;
+
+			auto reg = find_register(ctx, v->name);
+			if(reg == nullptr)
+				return;
+
+			// results can still have free variables, which a lambda around the register would capture.
+			for(auto& name : find_free_names(reg))
+			{
+				if(std::find_if(bound.begin(), bound.end(), [&name](auto b) { return *b == name; }) != bound.end())
+				{
+					return printError(zpr::sprint("register '{}' can't be used inside a lambda that binds its "
+						"free variable '{}'", v->name, name));
+				}
+			}
+
+			*expr = reg->clone();
+			delete v;
 		}
 		else if(auto a = dynamic_cast<Apply*>(*expr); a != nullptr)
 		{
-			auto ret = find_substitutions(&a->fn, var);
-			auto tmp = find_substitutions(&a->arg, var);
-			ret.insert(ret.end(), tmp.begin(), tmp.end());
-			return ret;
+			splice_registers(ctx, &a->fn, bound);
+			splice_registers(ctx, &a->arg, bound);
+		}
+		else if(auto l = dynamic_cast<Lambda*>(*expr); l != nullptr)
+		{
+			bound.push_back(&l->arg);
+			splice_registers(ctx, &l->body, bound);
+			bound.pop_back();
+		}
+	}
+
+	// registers hold results, which have no let-bound names left in them, so unlike let-bindings they
+	// can be put in as they are, without another round of replace_vars. they aren't renamed, so one
+	// with a free variable is refused under a binder of the same name. this runs after replace_vars,
+	// so a let-bound `it` takes precedence over the register.
+	void splice_registers(const Context& ctx, Expr** expr)
+	{
+		std::vector<const std::string*> bound;
+		splice_registers(ctx, expr, bound);
+	}
+
+	// marks the innermost of the leading lambdas of `name` as memoised, so that applying all of its
+	// arguments goes through ctx.memos. if the definition is an application (eg. `Y F`), this memoises
+	// the last argument instead, since that's the function the recursion actually goes through.
+	bool memoise(Context& ctx, const std::string& name)
+	{
+		std::set<const Expr*> seen;
+		std::string cur = name;
+
+		const Expr* expr = nullptr;
+		if(auto it = ctx.vars.find(name); it != ctx.vars.end())
+			expr = it->second;
+
+		while(expr != nullptr && seen.insert(expr).second)
+		{
+			if(auto v = dynamic_cast<const Var*>(expr); v != nullptr)
+			{
+				auto it = ctx.vars.find(v->name);
+				expr = (it == ctx.vars.end() ? nullptr : it->second);
+				cur = v->name;
+			}
+			else if(auto a = dynamic_cast<const Apply*>(expr); a != nullptr)
+			{
+				expr = a->arg;
+			}
+			else if(auto l = dynamic_cast<const Lambda*>(expr); l != nullptr)
+			{
+				while(auto inner = dynamic_cast<const Lambda*>(l->body))
+					l = inner;
+
+				auto& table = ctx.memos[name];
+				table.name = name;
+
+				const_cast<Lambda*>(l)->memo = &table;
+				return true;
+			}
+			else
+			{
+				abort();
+			}
+		}
+
+		printError(zpr::sprint("'{}' is not a function", cur));
+		return false;
+	}
+
+	// how many nodes have had a renaming applied to them, or pushed through them, on this thread.
+	// only used to compare eager and suspended renaming (see :bench).
+	thread_local size_t renamed_nodes = 0;
+
+	static void suspend(Expr* expr, const std::string& from, const std::string& to)
+	{
+		if(expr->renames == nullptr)
+			expr->renames = new std::vector<std::pair<std::string, std::string>>();
+
+		expr->renames->emplace_back(from, to);
+	}
+
+	// the same as alpha_conversion() does to a lambda, except that the body is left for later.
+	void rename_binder(Lambda* l, const std::string& name, const std::string& fresh)
+	{
+		if(l->arg == fresh)
+		{
+			auto fresher = fresh_name(fresh);
+			l->arg = fresher;
+
+			suspend(l->body, fresh, fresher);
+			suspend(l->body, name, fresh);
+		}
+		else
+		{
+			if(l->arg == name)
+				l->arg = fresh;
+
+			suspend(l->body, name, fresh);
+		}
+	}
+
+	// with FLAG_LAZY_RENAME, alpha conversion only renames the binder, and leaves the renaming of
+	// the body suspended on it. force() pushes a node's renamings down one level; it's only needed
+	// before a node is changed or printed, since the walks below can see through them.
+	void force(Expr* expr)
+	{
+		if(expr->renames == nullptr)
+			return;
+
+		renamed_nodes++;
+
+		auto renames = expr->renames;
+		expr->renames = nullptr;
+
+		if(auto v = dynamic_cast<Var*>(expr); v != nullptr)
+		{
+			for(auto& [ from, to ] : *renames)
+			{
+				if(v->name == from)
+					v->name = to;
+			}
+		}
+		else if(auto a = dynamic_cast<Apply*>(expr); a != nullptr)
+		{
+			for(auto& [ from, to ] : *renames)
+			{
+				suspend(a->fn, from, to);
+				suspend(a->arg, from, to);
+			}
+		}
+		else if(auto l = dynamic_cast<Lambda*>(expr); l != nullptr)
+		{
+			for(auto& [ from, to ] : *renames)
+				rename_binder(l, from, to);
+		}
+
+		delete renames;
+	}
+
+	void force_all(Expr* expr)
+	{
+		force(expr);
+		if(auto a = dynamic_cast<Apply*>(expr); a != nullptr)
+		{
+			force_all(a->fn);
+			force_all(a->arg);
+		}
+		else if(auto l = dynamic_cast<Lambda*>(expr); l != nullptr)
+		{
+			force_all(l->body);
+		}
+	}
+
+	namespace {
+		using Renames = std::vector<std::pair<std::string, std::string>>;
+
+		// the renamings that force() would eventually apply to a node: its own, and then the ones
+		// still suspended above it (which always came later).
+		struct Pending
+		{
+			Pending(const Expr* expr, const Renames& above) : list(&above)
+			{
+				if(expr->renames != nullptr)
+				{
+					this->own = *expr->renames;
+					this->own.insert(this->own.end(), above.begin(), above.end());
+					this->list = &this->own;
+				}
+			}
+
+			Pending(const Pending&) = delete;
+
+			const Renames* list;
+			Renames own;
+		};
+	}
+
+	// the name that a variable will have, once it's forced.
+	static const std::string& renamed(const std::string& name, const Renames& renames)
+	{
+		auto ret = &name;
+		for(auto& [ from, to ] : renames)
+		{
+			if(*ret == from)
+				ret = &to;
+		}
+
+		return *ret;
+	}
+
+	// the name that a lambda's binder will have once it's forced, and the renamings that will be
+	// suspended on its body; the same as rename_binder().
+	static std::string renamed_binder(std::string arg, const Renames& renames, Renames& body)
+	{
+		for(auto& [ from, to ] : renames)
+		{
+			if(arg == to)
+			{
+				auto fresher = fresh_name(to);
+				arg = fresher;
+
+				body.emplace_back(to, fresher);
+				body.emplace_back(from, to);
+			}
+			else
+			{
+				if(arg == from)
+					arg = to;
+
+				body.emplace_back(from, to);
+			}
+		}
+
+		return arg;
+	}
+
+	// anything that's about to be changed can't have renamings suspended above it anymore (or
+	// they'd get applied to whatever is put there), so the nodes leading to it are forced, parents
+	// first. `path` has them in that order; see the callers below.
+	static void force_path(const std::vector<Expr*>& path)
+	{
+		for(auto e : path)
+			force(e);
+	}
+
+	static void find_binders(Expr* expr, const std::string& name, const Renames& above, std::vector<Lambda*>& out,
+		std::vector<Expr*>& path)
+	{
+		auto found = out.size();
+		auto mark = path.size();
+		path.push_back(expr);
+
+		auto pending = Pending(expr, above);
+		if(auto a = dynamic_cast<Apply*>(expr); a != nullptr)
+		{
+			find_binders(a->fn, name, *pending.list, out, path);
+			find_binders(a->arg, name, *pending.list, out, path);
+		}
+		else if(auto l = dynamic_cast<Lambda*>(expr); l != nullptr)
+		{
+			Renames body;
+			if(renamed_binder(l->arg, *pending.list, body) == name)
+				out.push_back(l);
+			else
+				find_binders(l->body, name, body, out, path);
+		}
+
+		if(out.size() == found)
+			path.resize(mark);
+	}
+
+	// the outermost lambdas (from left to right) that bind `name`.
+	void find_binders(Expr* expr, const std::string& name, std::vector<Lambda*>& out)
+	{
+		std::vector<Expr*> path;
+		find_binders(expr, name, { }, out, path);
+
+		force_path(path);
+	}
+
+	static void find_substitutions(Expr** expr, const std::string& var, const Renames& above, std::vector<Expr**>& out,
+		std::vector<Expr*>& path)
+	{
+		auto found = out.size();
+		auto mark = path.size();
+		path.push_back(*expr);
+
+		auto pending = Pending(*expr, above);
+		if(auto v = dynamic_cast<Var*>(*expr); v != nullptr)
+		{
+			if(renamed(v->name, *pending.list) == var)
+				out.push_back(expr);
+		}
+		else if(auto a = dynamic_cast<Apply*>(*expr); a != nullptr)
+		{
+			find_substitutions(&a->fn, var, *pending.list, out, path);
+			find_substitutions(&a->arg, var, *pending.list, out, path);
 		}
 		else if(auto l = dynamic_cast<Lambda*>(*expr); l != nullptr)
 		{
 			// if the lambda here 're-binds' the name, then stop.
-			if(l->arg != var)   return find_substitutions(&l->body, var);
-			else                return { };
+			Renames body;
+			if(renamed_binder(l->arg, *pending.list, body) != var)
+				find_substitutions(&l->body, var, body, out, path);
 		}
 		else
 		{
 			abort();
 		}
+
+		if(out.size() == found)
+			path.resize(mark);
+	}
+
+	std::vector<Expr**> find_substitutions(Expr** expr, const std::string& var)
+	{
+		std::vector<Expr**> ret;
+		std::vector<Expr*> path;
+		find_substitutions(expr, var, { }, ret, path);
+
+		force_path(path);
+		return ret;
+	}
+
+	static void find_names(const Expr* expr, const Renames& above, std::vector<const std::string*>& bound,
+		std::set<std::string>* free, std::set<std::string>* binders)
+	{
+		auto pending = Pending(expr, above);
+		if(auto v = dynamic_cast<const Var*>(expr); v != nullptr)
+		{
+			auto& name = renamed(v->name, *pending.list);
+			if(free != nullptr && std::none_of(bound.begin(), bound.end(), [&](auto b) { return *b == name; }))
+				free->insert(name);
+		}
+		else if(auto a = dynamic_cast<const Apply*>(expr); a != nullptr)
+		{
+			find_names(a->fn, *pending.list, bound, free, binders);
+			find_names(a->arg, *pending.list, bound, free, binders);
+		}
+		else if(auto l = dynamic_cast<const Lambda*>(expr); l != nullptr)
+		{
+			Renames body;
+			auto arg = renamed_binder(l->arg, *pending.list, body);
+			if(binders != nullptr)
+				binders->insert(arg);
+
+			bound.push_back(&arg);
+			find_names(l->body, body, bound, free, binders);
+			bound.pop_back();
+		}
 	}
 
-	Lambda* substitute(Lambda* expr, const std::vector<Expr**>& vars, const Expr* value)
+	// like find_free_variables() and find_bound_variables(), but without forcing anything.
+	std::set<std::string> find_free_names(const Expr* expr)
 	{
-		for(auto v : vars)
-			*v = value->clone();
+		std::set<std::string> ret;
+		std::vector<const std::string*> bound;
+		find_names(expr, { }, bound, &ret, nullptr);
+
+		return ret;
+	}
+
+	std::set<std::string> find_binder_names(const Expr* expr)
+	{
+		std::set<std::string> ret;
+		std::vector<const std::string*> bound;
+		find_names(expr, { }, bound, nullptr, &ret);
+
+		return ret;
+	}
+
+	// this consumes `value`: it is moved into the last occurrence (so a linear redex doesn't
+	// copy anything), cloned for every other one, and freed if the variable was never used.
+	Lambda* substitute(Lambda* expr, const std::vector<Expr**>& vars, Expr* value)
+	{
+		if(vars.empty())
+		{
+			delete value;
+			return expr;
+		}
+
+		for(size_t i = 0; i < vars.size(); i++)
+		{
+			delete *vars[i];
+			*vars[i] = (i + 1 == vars.size() ? value : value->clone());
+		}
 
 		return expr;
 	}
@@ -111,6 +544,7 @@ namespace lc
 	>>
 	static Retty _find_variables(std::map<std::string, Lambda*> seen, const Expr* expr, int depth = 0)
 	{
+		force(const_cast<Expr*>(expr));
 		if(auto v = dynamic_cast<const Var*>(expr); v != nullptr)
 		{
 			if constexpr (Bound)
@@ -143,7 +577,14 @@ namespace lc
 			if(depth < MaxDepth)
 			{
 				seen.insert({ l->arg, const_cast<Lambda*>(l) });
-				return _find_variables<Bound>(seen, l->body, 1 + depth);
+				auto ret = _find_variables<Bound>(seen, l->body, 1 + depth);
+
+				// a binder can capture even if nothing refers to it; the outermost one wins,
+				// since renaming it also renames every same-named binder below it.
+				if constexpr (Bound)
+					ret[l->arg] = const_cast<Lambda*>(l);
+
+				return ret;
 			}
 			else
 			{
@@ -171,6 +612,19 @@ namespace lc
 		return name + "'";
 	}
 
+	size_t hash_expr(const Expr* expr)
+	{
+		return store::hash(store::Ast(), expr);
+	}
+
+	// also records { hash, need } for every node in the term; a node is closed if its need is 0.
+	size_t hash_subterms(const Expr* expr, std::unordered_map<const Expr*, std::pair<size_t, size_t>>& subterms)
+	{
+		size_t need = 0;
+		std::vector<const std::string*> bound;
+		return store::hash(store::Ast(), expr, bound, need, &subterms);
+	}
+
 
 
 
@@ -250,6 +704,31 @@ namespace lc
 		return false;
 	}
 
+	// unlike the one below, this does not evaluate anything; it compares the terms as they are.
+	bool alpha_equivalent(const Expr* a, const Expr* b)
+	{
+		return store::alpha_equivalent(store::Ast(), a, b);
+	}
+
+	// the same term, including the names of its binders.
+	bool identical(const Expr* a, const Expr* b)
+	{
+		if(auto v1 = dynamic_cast<const Var*>(a), v2 = dynamic_cast<const Var*>(b); v1 && v2)
+		{
+			return v1->name == v2->name;
+		}
+		else if(auto a1 = dynamic_cast<const Apply*>(a), a2 = dynamic_cast<const Apply*>(b); a1 && a2)
+		{
+			return identical(a1->fn, a2->fn) && identical(a1->arg, a2->arg);
+		}
+		else if(auto l1 = dynamic_cast<const Lambda*>(a), l2 = dynamic_cast<const Lambda*>(b); l1 && l2)
+		{
+			return l1->arg == l2->arg && identical(l1->body, l2->body);
+		}
+
+		return false;
+	}
+
 	bool alpha_equivalent(Context& ctx, const Expr* a, const Expr* b)
 	{
 		auto bb = lc::evaluate(ctx, b, /* flags: */ 0);
@@ -0,0 +1,31 @@
+#!/bin/sh
+# budget.sh
+# Copyright (c) 2021, zhiayang
+# Licensed under the Apache License Version 2.0.
+
+# with '--max-steps n', an assertion must pass if both of its sides reach a normal form in n steps
+# between them (even if that takes exactly n), and be over the limit otherwise.
+
+bin="${1:-build/lc}"
+dir="$(dirname "$0")"
+input="$dir/budget.lc"
+
+statuses() {
+	"$bin" --check --max-steps "$1" "$dir/../lib/bool.lc" "$input" | grep -a 'budget.lc:' \
+		| grep -ao 'pass\|fail\|limit' | tr '\n' ' '
+}
+
+expect() {
+	got="$(statuses "$1")"
+	if [ "$got" != "$2" ]; then
+		echo "budget.sh: with --max-steps $1, got '$got' instead of '$2'"
+		exit 1
+	fi
+}
+
+expect 3 'limit pass limit '
+expect 4 'pass pass limit '
+expect 7 'pass pass limit '
+expect 8 'pass pass pass '
+
+echo "budget.sh: assertions finish exactly at the limit, and share it between both sides"
@@ -0,0 +1,33 @@
+#!/bin/sh
+# fuse.sh
+# Copyright (c) 2021, zhiayang
+# Licensed under the Apache License Version 2.0.
+
+# with ':fuse', pipelines over lists that the evaluator can reduce completely must give the same
+# results; where a list is a free variable, the fused fold comes out more reduced, since the
+# evaluator doesn't reduce lambdas that are arguments to it. both are pinned here.
+
+bin="${1:-build/lc}"
+dir="$(dirname "$0")"
+lib="$dir/../lib"
+esc="$(printf '\033')"
+
+results() {
+	{ printf ':t\n:v\n%s' "$1"; cat "$dir/fuse.lc"; } | "$bin" "$lib/bool.lc" "$lib/num.lc" "$lib/list.lc" \
+		| grep -ao '\$[0-9]*:.*' | sed "s/$esc\[[0-9;]*m//g"
+}
+
+plain="$(mktemp)"
+fused="$(mktemp)"
+trap 'rm -f "$plain" "$fused"' EXIT
+
+results '' > "$plain"
+results ':fuse
+' > "$fused"
+
+if ! diff "$dir/fuse.plain" "$plain" || ! diff "$dir/fuse.fused" "$fused"; then
+	echo "fuse.sh: results changed"
+	exit 1
+fi
+
+echo "fuse.sh: $(wc -l < "$plain") results are as expected, with and without ':fuse'"
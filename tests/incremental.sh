@@ -0,0 +1,38 @@
+#!/bin/sh
+# incremental.sh
+# Copyright (c) 2021, zhiayang
+# Licensed under the Apache License Version 2.0.
+
+# reusing earlier results with ':i' must never change a result, so evaluate every line of
+# incremental.lc with and without it, and compare.
+
+bin="${1:-build/lc}"
+input="$(dirname "$0")/incremental.lc"
+
+results() {
+	{ printf ':t\n:v\n%s' "$1"; cat "$input"; } | "$bin" | grep -ao '\$[0-9]*:.*'
+}
+
+plain="$(mktemp)"
+incremental="$(mktemp)"
+trap 'rm -f "$plain" "$incremental"' EXIT
+
+results '' > "$plain"
+results ':i
+' > "$incremental"
+
+if ! diff "$plain" "$incremental"; then
+	echo "incremental.sh: results differ with ':i'"
+	exit 1
+fi
+
+# and it must actually reuse something; with tracing on, each input that did says so.
+expected=9
+reused="$({ printf ':v\n:i\n'; cat "$input"; } | "$bin" | grep -ac 'reused [0-9]* earlier result')"
+
+if [ "$reused" -ne "$expected" ]; then
+	echo "incremental.sh: $reused inputs reused an earlier result, instead of $expected"
+	exit 1
+fi
+
+echo "incremental.sh: $(wc -l < "$plain") results match, and $reused inputs reused an earlier result"
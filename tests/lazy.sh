@@ -0,0 +1,45 @@
+#!/bin/sh
+# lazy.sh
+# Copyright (c) 2021, zhiayang
+# Licensed under the Apache License Version 2.0.
+
+# suspending renamings with ':lazy' must not change anything that is printed, including full
+# traces; and when the renamed part of a term is thrown away, it must not get renamed at all.
+
+bin="${1:-build/lc}"
+input="$(dirname "$0")/lazy.lc"
+esc="$(printf '\033')"
+
+output() {
+	{ printf ':ft\n%s' "$1"; cat "$input"; } | "$bin" | sed "s/$esc\[[0-9;]*m//g; s/^.*λ> //" \
+		| grep -av 'suspended renaming\|full tracing\| steps, .* ms'
+}
+
+plain="$(mktemp)"
+lazy="$(mktemp)"
+trap 'rm -f "$plain" "$lazy"' EXIT
+
+output '' > "$plain"
+output ':lazy
+' > "$lazy"
+
+if ! diff "$plain" "$lazy"; then
+	echo "lazy.sh: output differs with ':lazy'"
+	exit 1
+fi
+
+# the ':bench' rows for the in-place evaluator, without and with suspended renaming.
+renamed() {
+	{ printf ':t\n'; cat "$input"; } | "$bin" | sed "s/$esc\[[0-9;]*m//g" \
+		| grep -a "^ *$1 .* renamed" | sed 's/.* \([0-9]*\) renamed.*/\1/'
+}
+
+eager="$(renamed in-place)"
+suspended="$(renamed lazy)"
+
+if [ -z "$eager" ] || [ -z "$suspended" ] || [ "$suspended" -ge "$eager" ]; then
+	echo "lazy.sh: ':lazy' renamed ${suspended:-?} nodes, and eager renaming ${eager:-?}"
+	exit 1
+fi
+
+echo "lazy.sh: $(grep -ac 'α-con' "$plain") renames traced the same; $suspended nodes renamed instead of $eager"
@@ -0,0 +1,28 @@
+#!/bin/sh
+# memo.sh
+# Copyright (c) 2021, zhiayang
+# Licensed under the Apache License Version 2.0.
+
+# memoising a function with ':memo' must never change a result, so evaluate every line of
+# memo.lc with and without the ':memo' lines, and compare.
+
+bin="${1:-build/lc}"
+input="$(dirname "$0")/memo.lc"
+
+results() {
+	{ printf ':t\n:v\n'; grep -v "$1" "$input"; } | "$bin" | grep -ao '\$[0-9]*:.*'
+}
+
+plain="$(mktemp)"
+memoised="$(mktemp)"
+trap 'rm -f "$plain" "$memoised"' EXIT
+
+results '^:memo' > "$plain"
+results '^$' > "$memoised"
+
+if ! diff "$plain" "$memoised"; then
+	echo "memo.sh: results differ with ':memo'"
+	exit 1
+fi
+
+echo "memo.sh: $(wc -l < "$plain") results match"